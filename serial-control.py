@@ -2,7 +2,10 @@
 # -*- coding: utf-8 -*-
 #
 # Log the temperatures reported by the oven in a live plot and
-# in a CSV file.
+# in a CSV file, or transfer reflow profiles:
+#
+#   serial-control.py get <id> <file>   Save profile id to a text file
+#   serial-control.py put <id> <file>   Write custom profile id from a text file
 #
 # Requires
 # python 2.7
@@ -15,6 +18,7 @@ import datetime
 import matplotlib.pyplot as plt
 import matplotlib.gridspec as gridspec
 import serial
+import struct
 import sys
 from time import time
 
@@ -26,6 +30,9 @@ BAUD_RATE = 115200
 
 logdir = 'logs/'
 
+XFER_STX = 0x02
+XFER_TIMEOUT = 5
+
 MAX_X = 470
 MAX_Y_temperature = 300
 MAX_Y_pwm = 260
@@ -246,6 +253,94 @@ def loop_all_profiles(num_profiles=6):
 
 			log.process_log(logline)
 
+# Profile files have one segment per line: target temperature in C, ramp rate in C/s
+# (0 steps straight to the target) and hold time in seconds. The first segment is
+# where the profile starts, its rate is not used.
+def encode_profile(text):
+	segments = []
+	for line in text.splitlines():
+		line = line.split('#')[0].strip()
+		if not line:
+			continue
+		target, rate, hold = line.split()
+		target, rate, hold = int(target), int(round(float(rate) * 10)), int(hold)
+		if not 0 < target <= 300 or not 0 <= rate <= 255 or hold < 0:
+			raise ValueError('Invalid segment: %s' % line)
+		segments.append((target, rate, min(hold, 127)))
+		hold -= 127
+		while hold > 0:
+			segments.append((target, 0, min(hold, 127)))
+			hold -= 127
+
+	record = bytearray([len(segments)])
+	for target, rate, hold in segments:
+		record += bytearray([target & 0xff, ((target >> 1) & 0x80) | hold, rate])
+	return record
+
+def decode_profile(record):
+	lines = ['# target rate hold']
+	for i in range(record[0]):
+		b = record[1 + i * 3:4 + i * 3]
+		target = b[0] | ((b[1] & 0x80) << 1)
+		lines.append('%d %.1f %d' % (target, b[2] / 10.0, b[1] & 0x7f))
+	return '\n'.join(lines) + '\n'
+
+def crc16(data):
+	crc = 0xffff
+	for b in data:
+		crc ^= b << 8
+		for i in range(8):
+			crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+		crc &= 0xffff
+	return crc
+
+def wait_for(port, *prefixes):
+	while True:
+		line = port.readline()
+		if not line:
+			raise IOError('Timed out waiting for the oven')
+		line = line.decode('ascii', 'replace').strip()
+		if line.startswith(prefixes):
+			return line
+
+def profile_get(port, profile):
+	port.write(('profile get %d\n' % profile).encode('ascii'))
+	line = wait_for(port, 'Profile %d' % profile, 'No profile')
+	if not line.startswith('Profile'):
+		raise IOError(line)
+	while bytearray(port.read(1)) != bytearray([XFER_STX]):
+		pass
+	length = bytearray(port.read(1))
+	record = bytearray(port.read(length[0]))
+	crc = struct.unpack('>H', port.read(2))[0]
+	if crc != crc16(length + record):
+		raise IOError('Bad CRC in profile %d' % profile)
+	return record
+
+def profile_put(port, profile, record):
+	port.write(('profile put %d\n' % profile).encode('ascii'))
+	line = wait_for(port, 'Ready for profile', 'Only custom')
+	if not line.startswith('Ready'):
+		raise IOError(line)
+	frame = bytearray([XFER_STX, len(record)]) + record
+	frame += struct.pack('>H', crc16(frame[1:]))
+	port.write(bytes(frame))
+	line = wait_for(port, 'Profile %d stored' % profile, 'Profile transfer')
+	if 'stored' not in line:
+		raise IOError(line)
+	return line
+
+def transfer_profile(action, profile, filename):
+	with get_tty() as port:
+		port.timeout = XFER_TIMEOUT
+		if action == 'get':
+			with open(filename, 'w') as f:
+				f.write(decode_profile(profile_get(port, profile)))
+			print('Saved profile %d in %s' % (profile, filename))
+		else:
+			with open(filename) as f:
+				print(profile_put(port, profile, encode_profile(f.read())))
+
 def logging_only():
 	log = Log()
 
@@ -263,5 +358,8 @@ if __name__ == '__main__':
 	elif action == 'test':
 		print 'Looping over all profiles'
 		loop_all_profiles()
+
+	elif action in ('get', 'put') and len(sys.argv) == 4:
+		transfer_profile(action, int(sys.argv[2]), sys.argv[3])
 	else:
 		print 'Unknown action', action
@@ -0,0 +1,209 @@
+/*
+ * lpc214x_sim.h - LPC214x register stand-ins for the host simulation build
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// This header is force-included ahead of every source file in the host build
+// (see the 'host' target in the Makefile). It claims the include guard of the
+// real LPC214x.h and turns every peripheral register into a call into the
+// simulation, so the firmware sources compile unmodified for Linux.
+
+#ifndef LPC214X_SIM_H_
+#define LPC214X_SIM_H_
+
+#ifndef __ASSEMBLER__
+
+#define __LPC214x_H
+
+#include <stdint.h>
+
+// Only registers actually used by the firmware are simulated, add new ones here
+#define SIM_REGISTERS(X) \
+	X(AD0CR) \
+	X(AD0DR1) \
+	X(AD0DR2) \
+	X(CCR) \
+	X(CTIME0) \
+	X(FIO0CLR) \
+	X(FIO0DIR) \
+	X(FIO0MASK) \
+	X(FIO0PIN) \
+	X(FIO0SET) \
+	X(FIO1DIR) \
+	X(FIO1MASK) \
+	X(FIO1PIN) \
+	X(HOUR) \
+	X(I20CONCLR) \
+	X(I20CONSET) \
+	X(I20DAT) \
+	X(I20SCLH) \
+	X(I20SCLL) \
+	X(I20STAT) \
+	X(IODIR0) \
+	X(IOPIN0) \
+	X(IOSET0) \
+	X(MAMCR) \
+	X(MAMTIM) \
+	X(MIN) \
+	X(PCON) \
+	X(PINSEL0) \
+	X(PINSEL1) \
+	X(PLLCFG) \
+	X(PLLCON) \
+	X(PLLFEED) \
+	X(PLLSTAT) \
+	X(PREFRAC) \
+	X(PREINT) \
+	X(PWMLER) \
+	X(PWMMCR) \
+	X(PWMMR0) \
+	X(PWMMR4) \
+	X(PWMMR6) \
+	X(PWMPCR) \
+	X(PWMPR) \
+	X(PWMTCR) \
+	X(RSIR) \
+	X(SCS) \
+	X(SEC) \
+	X(T0CTCR) \
+	X(T0IR) \
+	X(T0MCR) \
+	X(T0MR0) \
+	X(T0PR) \
+	X(T0TC) \
+	X(T0TCR) \
+	X(T1CTCR) \
+	X(T1IR) \
+	X(T1MCR) \
+	X(T1MR0) \
+	X(T1PR) \
+	X(T1TC) \
+	X(T1TCR) \
+	X(U0DLL) \
+	X(U0DLM) \
+	X(U0FCR) \
+	X(U0FDR) \
+	X(U0IER) \
+	X(U0IIR) \
+	X(U0LCR) \
+	X(U0RBR) \
+	X(U0THR) \
+	X(VICVectAddr) \
+	X(VPBDIV) \
+	X(WDFEED) \
+	X(WDMOD) \
+	X(WDTC) \
+
+typedef enum eSimReg {
+#define SIM_REG_ENUM(r) SIM_##r,
+	SIM_REGISTERS(SIM_REG_ENUM)
+#undef SIM_REG_ENUM
+	SIM_NUM_REGS // Last value
+} SimReg_t;
+
+// Returns the storage for a register. A read sees the current simulated value,
+// a write is picked up when the next register is accessed or on Sim_Sync().
+volatile uint32_t* Sim_Reg(SimReg_t reg);
+
+#define AD0CR (*Sim_Reg(SIM_AD0CR))
+#define AD0DR1 (*Sim_Reg(SIM_AD0DR1))
+#define AD0DR2 (*Sim_Reg(SIM_AD0DR2))
+#define CCR (*Sim_Reg(SIM_CCR))
+#define CTIME0 (*Sim_Reg(SIM_CTIME0))
+#define FIO0CLR (*Sim_Reg(SIM_FIO0CLR))
+#define FIO0DIR (*Sim_Reg(SIM_FIO0DIR))
+#define FIO0MASK (*Sim_Reg(SIM_FIO0MASK))
+#define FIO0PIN (*Sim_Reg(SIM_FIO0PIN))
+#define FIO0SET (*Sim_Reg(SIM_FIO0SET))
+#define FIO1DIR (*Sim_Reg(SIM_FIO1DIR))
+#define FIO1MASK (*Sim_Reg(SIM_FIO1MASK))
+#define FIO1PIN (*Sim_Reg(SIM_FIO1PIN))
+#define HOUR (*Sim_Reg(SIM_HOUR))
+#define I20CONCLR (*Sim_Reg(SIM_I20CONCLR))
+#define I20CONSET (*Sim_Reg(SIM_I20CONSET))
+#define I20DAT (*Sim_Reg(SIM_I20DAT))
+#define I20SCLH (*Sim_Reg(SIM_I20SCLH))
+#define I20SCLL (*Sim_Reg(SIM_I20SCLL))
+#define I20STAT (*Sim_Reg(SIM_I20STAT))
+#define IODIR0 (*Sim_Reg(SIM_IODIR0))
+#define IOPIN0 (*Sim_Reg(SIM_IOPIN0))
+#define IOSET0 (*Sim_Reg(SIM_IOSET0))
+#define MAMCR (*Sim_Reg(SIM_MAMCR))
+#define MAMTIM (*Sim_Reg(SIM_MAMTIM))
+#define MIN (*Sim_Reg(SIM_MIN))
+#define PCON (*Sim_Reg(SIM_PCON))
+#define PINSEL0 (*Sim_Reg(SIM_PINSEL0))
+#define PINSEL1 (*Sim_Reg(SIM_PINSEL1))
+#define PLLCFG (*Sim_Reg(SIM_PLLCFG))
+#define PLLCON (*Sim_Reg(SIM_PLLCON))
+#define PLLFEED (*Sim_Reg(SIM_PLLFEED))
+#define PLLSTAT (*Sim_Reg(SIM_PLLSTAT))
+#define PREFRAC (*Sim_Reg(SIM_PREFRAC))
+#define PREINT (*Sim_Reg(SIM_PREINT))
+#define PWMLER (*Sim_Reg(SIM_PWMLER))
+#define PWMMCR (*Sim_Reg(SIM_PWMMCR))
+#define PWMMR0 (*Sim_Reg(SIM_PWMMR0))
+#define PWMMR4 (*Sim_Reg(SIM_PWMMR4))
+#define PWMMR6 (*Sim_Reg(SIM_PWMMR6))
+#define PWMPCR (*Sim_Reg(SIM_PWMPCR))
+#define PWMPR (*Sim_Reg(SIM_PWMPR))
+#define PWMTCR (*Sim_Reg(SIM_PWMTCR))
+#define RSIR (*Sim_Reg(SIM_RSIR))
+#define SCS (*Sim_Reg(SIM_SCS))
+#define SEC (*Sim_Reg(SIM_SEC))
+#define T0CTCR (*Sim_Reg(SIM_T0CTCR))
+#define T0IR (*Sim_Reg(SIM_T0IR))
+#define T0MCR (*Sim_Reg(SIM_T0MCR))
+#define T0MR0 (*Sim_Reg(SIM_T0MR0))
+#define T0PR (*Sim_Reg(SIM_T0PR))
+#define T0TC (*Sim_Reg(SIM_T0TC))
+#define T0TCR (*Sim_Reg(SIM_T0TCR))
+#define T1CTCR (*Sim_Reg(SIM_T1CTCR))
+#define T1IR (*Sim_Reg(SIM_T1IR))
+#define T1MCR (*Sim_Reg(SIM_T1MCR))
+#define T1MR0 (*Sim_Reg(SIM_T1MR0))
+#define T1PR (*Sim_Reg(SIM_T1PR))
+#define T1TC (*Sim_Reg(SIM_T1TC))
+#define T1TCR (*Sim_Reg(SIM_T1TCR))
+#define U0DLL (*Sim_Reg(SIM_U0DLL))
+#define U0DLM (*Sim_Reg(SIM_U0DLM))
+#define U0FCR (*Sim_Reg(SIM_U0FCR))
+#define U0FDR (*Sim_Reg(SIM_U0FDR))
+#define U0IER (*Sim_Reg(SIM_U0IER))
+#define U0IIR (*Sim_Reg(SIM_U0IIR))
+#define U0LCR (*Sim_Reg(SIM_U0LCR))
+#define U0RBR (*Sim_Reg(SIM_U0RBR))
+#define U0THR (*Sim_Reg(SIM_U0THR))
+#define VICVectAddr (*Sim_Reg(SIM_VICVectAddr))
+#define VPBDIV (*Sim_Reg(SIM_VPBDIV))
+#define WDFEED (*Sim_Reg(SIM_WDFEED))
+#define WDMOD (*Sim_Reg(SIM_WDMOD))
+#define WDTC (*Sim_Reg(SIM_WDTC))
+
+// Boot ROM and flash locations used by io.c
+void Sim_IAP(unsigned int command[], unsigned int result[]);
+extern uint8_t Sim_PartRev;
+#define IAP_ENTRY (Sim_IAP)
+#define PART_REV_ADDR ((uintptr_t)&Sim_PartRev)
+
+// Only writable profiles live at or above this address on the host
+extern char __data_start[];
+#define RAM_START_ADDR ((void*)__data_start)
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* LPC214X_SIM_H_ */
@@ -0,0 +1,127 @@
+/*
+ * oven.c - Lumped-parameter thermal model of the T-962 oven
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "oven.h"
+
+/*
+ * Two thermal masses, the chamber (air, tray, walls) and the board. The heater
+ * elements have their own first order lag and split their output between the
+ * chamber (convection) and the board (radiation). The chamber loses heat to the
+ * ambient, a lot more so with the fan running. The thermocouples sit in the
+ * chamber air and lag behind it.
+ *
+ * Defaults are ballpark figures for a stock T-962: ~2.5C/s initial ramp at full
+ * power, topping out somewhere around 280C, and a fan that can pull the chamber
+ * down at a few C/s from reflow temperatures.
+ */
+
+// Integration step limit, comfortably below the shortest time constant
+#define OVEN_MAX_STEP (0.05f)
+
+void Oven_DefaultParams(OvenParams_t* p) {
+	p->ambient = 25.0f;
+	p->heaterpower = 800.0f;
+	p->heatertau = 6.0f;
+	p->radiantfrac = 0.3f;
+	p->cchamber = 260.0f;
+	p->cboard = 60.0f;
+	p->kboard = 3.0f;
+	p->kloss = 3.1f;
+	p->kfan = 10.0f;
+	p->tctau = 2.0f;
+	p->tcskew = 0.0f;
+}
+
+static const struct {
+	const char* name;
+	size_t offset;
+} paramnames[] = {
+	{ "ambient", offsetof(OvenParams_t, ambient) },
+	{ "heaterpower", offsetof(OvenParams_t, heaterpower) },
+	{ "heatertau", offsetof(OvenParams_t, heatertau) },
+	{ "radiantfrac", offsetof(OvenParams_t, radiantfrac) },
+	{ "cchamber", offsetof(OvenParams_t, cchamber) },
+	{ "cboard", offsetof(OvenParams_t, cboard) },
+	{ "kboard", offsetof(OvenParams_t, kboard) },
+	{ "kloss", offsetof(OvenParams_t, kloss) },
+	{ "kfan", offsetof(OvenParams_t, kfan) },
+	{ "tctau", offsetof(OvenParams_t, tctau) },
+	{ "tcskew", offsetof(OvenParams_t, tcskew) },
+};
+#define NUM_PARAMS (sizeof(paramnames) / sizeof(paramnames[0]))
+
+// Overrides parameters from a "name=value,name=value" string, returns -1 on unknown names
+int32_t Oven_ParseParams(OvenParams_t* p, const char* str) {
+	int32_t retval = 0;
+	while (str && *str) {
+		size_t len = strcspn(str, "=,");
+		if (str[len] == '=') {
+			uint32_t i;
+			for (i = 0; i < NUM_PARAMS; i++) {
+				if (strlen(paramnames[i].name) == len && !strncmp(str, paramnames[i].name, len)) {
+					*(float*)((char*)p + paramnames[i].offset) = strtof(str + len + 1, NULL);
+					break;
+				}
+			}
+			if (i == NUM_PARAMS) {
+				fprintf(stderr, "\noven: unknown parameter '%.*s'", (int)len, str);
+				retval = -1;
+			}
+			len += strcspn(str + len, ",");
+		}
+		str += len;
+		if (*str == ',') str++;
+	}
+	return retval;
+}
+
+void Oven_Init(Oven_t* oven, const OvenParams_t* p) {
+	oven->p = *p;
+	oven->heater = 0.0f;
+	oven->chamber = oven->board = p->ambient;
+	oven->tc[0] = oven->tc[1] = p->ambient;
+}
+
+// Advances the model dt seconds with heater and fan duty cycles between 0.0 and 1.0
+void Oven_Step(Oven_t* oven, float heater, float fan, float dt) {
+	const OvenParams_t* p = &oven->p;
+	while (dt > 0.0f) {
+		float h = dt > OVEN_MAX_STEP ? OVEN_MAX_STEP : dt;
+		dt -= h;
+
+		oven->heater += (heater - oven->heater) * h / p->heatertau;
+		float power = oven->heater * p->heaterpower;
+		float toboard = p->kboard * (oven->chamber - oven->board);
+		float loss = (p->kloss + p->kfan * fan) * (oven->chamber - p->ambient);
+
+		oven->chamber += (power * (1.0f - p->radiantfrac) - toboard - loss) * h / p->cchamber;
+		oven->board += (power * p->radiantfrac + toboard) * h / p->cboard;
+		oven->tc[0] += (oven->chamber + p->tcskew - oven->tc[0]) * h / p->tctau;
+		oven->tc[1] += (oven->chamber - p->tcskew - oven->tc[1]) * h / p->tctau;
+	}
+}
+
+float Oven_GetTC(const Oven_t* oven, uint32_t ch) {
+	return ch < 2 ? oven->tc[ch] : oven->p.ambient;
+}
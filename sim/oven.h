@@ -0,0 +1,53 @@
+/*
+ * oven.h - Lumped-parameter thermal model of the T-962 oven
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OVEN_H_
+#define OVEN_H_
+
+#include <stdint.h>
+
+typedef struct {
+	float ambient; // degC, also the cold junction temperature
+	float heaterpower; // W at 100% duty cycle
+	float heatertau; // s, warm-up/cool-down time constant of the heater elements
+	float radiantfrac; // Share of the heater power going straight into the board
+	float cchamber; // J/K, chamber air, tray and walls
+	float cboard; // J/K, board and components
+	float kboard; // W/K, chamber <-> board
+	float kloss; // W/K, chamber -> ambient with the fan off
+	float kfan; // W/K, additional loss with the fan at 100%
+	float tctau; // s, thermocouple time constant
+	float tcskew; // degC, left TC reads this much above the chamber, right this much below
+} OvenParams_t;
+
+typedef struct {
+	OvenParams_t p;
+	float heater; // Heater element output, 0.0 - 1.0
+	float chamber;
+	float board;
+	float tc[2];
+} Oven_t;
+
+void Oven_DefaultParams(OvenParams_t* p);
+int32_t Oven_ParseParams(OvenParams_t* p, const char* str);
+void Oven_Init(Oven_t* oven, const OvenParams_t* p);
+void Oven_Step(Oven_t* oven, float heater, float fan, float dt);
+float Oven_GetTC(const Oven_t* oven, uint32_t ch);
+
+#endif /* OVEN_H_ */
@@ -0,0 +1,312 @@
+/*
+ * owbus.c - Simulated 1-wire bus with DS18B20 and MAX31850 slaves
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "t962.h"
+#include "sched.h"
+#include "sim.h"
+#include "owbus.h"
+
+/*
+ * The slaves only see the edges of the master driving P0.7. A falling edge
+ * starts a time slot, a slave sending a zero holds the bus low from there
+ * until 30us later. The rising edge ends the low part of the slot, how long
+ * the master held the bus low tells a written 1 (<15us) from a 0, and a very
+ * long low time is a reset which is answered by a presence pulse.
+ *
+ * SIM_ONEWIRE lists the devices on the bus, for example "ds18b20,max31850,max31850".
+ * Thermocouple interfaces get IDs 0, 1, ... in order and read the matching
+ * channel of the oven model, the temperature sensor reads the ambient. Adding
+ * "biterrors=<probability>" to the list makes the slaves send the occasional
+ * wrong bit when returning their scratchpad.
+ */
+
+#define US_TICKS(x) ((uint64_t)((x) * SIM_TICKS_PER_SEC / 1e6))
+
+#define OW_MAX_DEVICES (5)
+#define OW_FAMILY_DS18B20 (0x28)
+#define OW_FAMILY_MAX31850 (0x3b)
+
+typedef enum {
+	OWD_IDLE = 0, // Not addressed, waits for the next reset
+	OWD_ROMCMD,
+	OWD_MATCHROM,
+	OWD_SEARCHROM,
+	OWD_READROM,
+	OWD_FUNCCMD,
+	OWD_READSCRATCH,
+	OWD_WRITESCRATCH,
+} OWDevState_t;
+
+typedef struct {
+	uint8_t rom[8];
+	uint8_t scratch[9];
+	uint8_t tcid;
+	OWDevState_t state;
+	uint8_t data[9]; // Bits being shifted in or out
+	uint8_t bitpos;
+	uint8_t numbits;
+	uint8_t sending;
+	uint8_t searchphase; // Sending ROM bit, its complement, reading the direction
+	uint64_t lowuntil; // Slave holds the bus low until this time
+} OWDev_t;
+
+static OWDev_t devs[OW_MAX_DEVICES];
+static int numdevs = 0;
+static int masterlow = 0;
+static uint64_t fallticks = 0;
+static uint64_t presencefrom = 0;
+static uint64_t presenceuntil = 0;
+static float biterrors = 0.0f;
+static uint32_t noise = 12345;
+
+static uint8_t OWBus_CRC8(const uint8_t* buf, int len) {
+	uint8_t crc = 0;
+	while (len--) {
+		crc ^= *buf++;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8c : crc >> 1;
+		}
+	}
+	return crc;
+}
+
+// Latches a new reading into the scratchpad, the conversion itself is instantaneous
+static void OWBus_Convert(OWDev_t* d) {
+	const Oven_t* o = Sim_GetOven();
+	if (d->rom[0] == OW_FAMILY_MAX31850) {
+		int16_t tc = (int16_t)(Oven_GetTC(o, d->tcid) * 4.0f) << 2; // 0.25C, D0 is the fault bit
+		int16_t cj = (int16_t)(o->p.ambient * 16.0f) << 4; // 0.0625C, D2-D0 are fault bits
+		d->scratch[0] = tc;
+		d->scratch[1] = tc >> 8;
+		d->scratch[2] = cj;
+		d->scratch[3] = cj >> 8;
+	} else {
+		int unused = 3 - ((d->scratch[4] >> 5) & 3); // Undefined LSBs at lower resolutions
+		int16_t t = (int16_t)(o->p.ambient * 16.0f) & ~((1 << unused) - 1);
+		d->scratch[0] = t;
+		d->scratch[1] = t >> 8;
+	}
+	d->scratch[8] = OWBus_CRC8(d->scratch, 8);
+}
+
+static void OWBus_Start(OWDev_t* d, OWDevState_t state, const uint8_t* txdata, int numbits) {
+	d->state = state;
+	d->bitpos = 0;
+	d->numbits = numbits;
+	d->sending = (txdata != NULL);
+	if (txdata) {
+		memcpy(d->data, txdata, (numbits + 7) / 8);
+	}
+}
+
+// A complete command or data block was received
+static void OWBus_Received(OWDev_t* d) {
+	switch (d->state) {
+		case OWD_ROMCMD:
+			if (d->data[0] == 0xf0) {
+				d->state = OWD_SEARCHROM;
+				d->bitpos = 0;
+				d->searchphase = 0;
+			} else if (d->data[0] == 0x55) {
+				OWBus_Start(d, OWD_MATCHROM, NULL, 64);
+			} else if (d->data[0] == 0x33) {
+				OWBus_Start(d, OWD_READROM, d->rom, 64);
+			} else if (d->data[0] == 0xcc) {
+				OWBus_Start(d, OWD_FUNCCMD, NULL, 8);
+			} else {
+				d->state = OWD_IDLE;
+			}
+			break;
+		case OWD_MATCHROM:
+			if (memcmp(d->data, d->rom, 8) == 0) {
+				OWBus_Start(d, OWD_FUNCCMD, NULL, 8);
+			} else {
+				d->state = OWD_IDLE;
+			}
+			break;
+		case OWD_FUNCCMD:
+			if (d->data[0] == 0x44) {
+				OWBus_Convert(d);
+				d->state = OWD_IDLE;
+			} else if (d->data[0] == 0xbe) {
+				OWBus_Start(d, OWD_READSCRATCH, d->scratch, 72);
+			} else if (d->data[0] == 0x4e && d->rom[0] == OW_FAMILY_DS18B20) {
+				OWBus_Start(d, OWD_WRITESCRATCH, NULL, 24);
+			} else {
+				d->state = OWD_IDLE;
+			}
+			break;
+		case OWD_WRITESCRATCH:
+			d->scratch[2] = d->data[0];
+			d->scratch[3] = d->data[1];
+			d->scratch[4] = (d->data[2] & 0x60) | 0x1f;
+			d->scratch[8] = OWBus_CRC8(d->scratch, 8);
+			d->state = OWD_IDLE;
+			break;
+		default:
+			d->state = OWD_IDLE;
+			break;
+	}
+}
+
+// Bit the slave puts on the bus in the current slot, 1 leaves it alone
+static int OWBus_TxBit(OWDev_t* d) {
+	if (d->state == OWD_SEARCHROM) {
+		if (d->searchphase == 2) return 1;
+		int bit = (d->rom[d->bitpos >> 3] >> (d->bitpos & 7)) & 1;
+		return d->searchphase ? !bit : bit;
+	}
+	if (d->state == OWD_IDLE || !d->sending || d->bitpos >= d->numbits) {
+		return 1;
+	}
+	int bit = (d->data[d->bitpos >> 3] >> (d->bitpos & 7)) & 1;
+	if (biterrors > 0.0f && d->state == OWD_READSCRATCH) {
+		noise = noise * 1103515245 + 12345;
+		if ((float)(noise >> 8) / 16777216.0f < biterrors) {
+			bit = !bit;
+		}
+	}
+	return bit;
+}
+
+// Master released the bus, the slot is over
+static void OWBus_SlotDone(OWDev_t* d, int bit) {
+	if (d->state == OWD_SEARCHROM) {
+		if (d->searchphase < 2) {
+			d->searchphase++;
+		} else if (bit != ((d->rom[d->bitpos >> 3] >> (d->bitpos & 7)) & 1)) {
+			d->state = OWD_IDLE; // Master went the other way
+		} else if (++d->bitpos == 64) {
+			OWBus_Start(d, OWD_FUNCCMD, NULL, 8);
+		} else {
+			d->searchphase = 0;
+		}
+		return;
+	}
+	if (d->state == OWD_IDLE || d->bitpos >= d->numbits) {
+		return;
+	}
+	if (!d->sending) {
+		if (bit) {
+			d->data[d->bitpos >> 3] |= 1 << (d->bitpos & 7);
+		} else {
+			d->data[d->bitpos >> 3] &= ~(1 << (d->bitpos & 7));
+		}
+	}
+	if (++d->bitpos == d->numbits) {
+		if (d->sending) {
+			d->state = OWD_IDLE; // Trailing read slots just see ones
+		} else {
+			OWBus_Received(d);
+		}
+	}
+}
+
+// Master started or stopped pulling the bus low
+void OWBus_Drive(uint64_t ticks, int low) {
+	if (low == masterlow) return;
+	masterlow = low;
+	if (low) {
+		fallticks = ticks;
+		for (int i = 0; i < numdevs; i++) {
+			if (!OWBus_TxBit(&devs[i])) {
+				devs[i].lowuntil = ticks + US_TICKS(30);
+			}
+		}
+	} else {
+		uint64_t lowticks = ticks - fallticks;
+		if (lowticks >= US_TICKS(400)) {
+			for (int i = 0; i < numdevs; i++) {
+				OWBus_Start(&devs[i], OWD_ROMCMD, NULL, 8);
+			}
+			if (numdevs) {
+				presencefrom = ticks + US_TICKS(30);
+				presenceuntil = ticks + US_TICKS(150);
+			}
+		} else {
+			int bit = lowticks < US_TICKS(15);
+			for (int i = 0; i < numdevs; i++) {
+				OWBus_SlotDone(&devs[i], bit);
+			}
+		}
+	}
+}
+
+// Bus level, 0 if anyone pulls it low
+int OWBus_Sample(uint64_t ticks) {
+	if (masterlow || (ticks >= presencefrom && ticks < presenceuntil)) {
+		return 0;
+	}
+	for (int i = 0; i < numdevs; i++) {
+		if (ticks < devs[i].lowuntil) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void OWBus_AddDevice(uint8_t family, uint8_t tcid) {
+	OWDev_t* d = &devs[numdevs];
+	memset(d, 0, sizeof(OWDev_t));
+	d->rom[0] = family;
+	d->rom[1] = 0x10 + numdevs;
+	d->rom[2] = 0x5a;
+	d->rom[7] = OWBus_CRC8(d->rom, 7);
+	d->tcid = tcid;
+	if (family == OW_FAMILY_MAX31850) {
+		memset(&d->scratch[4], 0xff, 4);
+		d->scratch[4] = 0xf0 | tcid; // AD3-AD0 address inputs
+	} else {
+		d->scratch[4] = 0x7f; // 12-bit resolution after power-up
+		d->scratch[5] = 0xff;
+		d->scratch[6] = 0x0c;
+		d->scratch[7] = 0x10;
+	}
+	OWBus_Convert(d);
+	numdevs++;
+}
+
+// Sets up the devices from a "ds18b20,max31850,...,biterrors=x" list, returns -1 on unknown names
+int32_t OWBus_Init(const char* config) {
+	uint8_t numtc = 0;
+	numdevs = 0;
+	while (config && *config) {
+		size_t len = strcspn(config, ",");
+		if (len > 10 && !strncmp(config, "biterrors=", 10)) {
+			biterrors = strtof(config + 10, NULL);
+		} else if (numdevs == OW_MAX_DEVICES) {
+			fprintf(stderr, "\nowbus: too many devices");
+			return -1;
+		} else if (len == 7 && !strncmp(config, "ds18b20", len)) {
+			OWBus_AddDevice(OW_FAMILY_DS18B20, 0);
+		} else if (len == 8 && !strncmp(config, "max31850", len)) {
+			OWBus_AddDevice(OW_FAMILY_MAX31850, numtc++);
+		} else {
+			fprintf(stderr, "\nowbus: unknown device '%.*s'", (int)len, config);
+			return -1;
+		}
+		config += len;
+		if (*config == ',') config++;
+	}
+	return 0;
+}
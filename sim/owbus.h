@@ -0,0 +1,29 @@
+/*
+ * owbus.h - Simulated 1-wire bus with DS18B20 and MAX31850 slaves
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OWBUS_H_
+#define OWBUS_H_
+
+#include <stdint.h>
+
+int32_t OWBus_Init(const char* config);
+void OWBus_Drive(uint64_t ticks, int low);
+int OWBus_Sample(uint64_t ticks);
+
+#endif /* OWBUS_H_ */
@@ -0,0 +1,718 @@
+/*
+ * sim.c - Host-side simulation of the T-962 controller hardware
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "t962.h"
+#include "sched.h"
+#include "vic.h"
+#include "sim.h"
+#include "oven.h"
+#include "owbus.h"
+#include "spibridge.h"
+
+/*
+ * Virtual time is Timer0 ticks. It only moves forward when the firmware touches
+ * a peripheral register (SIM_ACCESS_TICKS each, this keeps polling loops like
+ * BusyWait going) and when the core enters idle mode through PCON. Idling jumps
+ * straight to the next wake-up source so a full reflow profile runs in a tiny
+ * fraction of real time. Set SIM_REALTIME=1 in the environment to pace virtual
+ * time to the wall clock instead, which makes the serial console usable.
+ *
+ * Environment variables:
+ *  SIM_SECONDS   Virtual seconds to run before exiting (default 600)
+ *  SIM_REALTIME  Run at wall clock speed when set to 1
+ *  SIM_EEPROM    File to load the I2C EEPROM contents from and save them to
+ *  SIM_OVEN      Thermal model overrides, "name=value,..." (see oven.c)
+ *  SIM_ONEWIRE   Devices on the 1-wire bus, "ds18b20,max31850,..." (see owbus.c)
+ *  SIM_SPITC     Adds the I2C to SPI bridge, "max31855,max31855,..." (see spibridge.c)
+ *
+ * Serial input is read from stdin and output goes straight to stdout, printf
+ * directly and binary transfers through the UART transmit register.
+ */
+
+#define SIM_ACCESS_TICKS (1)
+#define SIM_DEFAULT_SECONDS (600)
+
+// Time for one character at 115200 baud 8N1
+#define SIM_UART_CHAR_TICKS ((uint64_t)(SIM_TICKS_PER_SEC * 10 / 115200))
+
+#define EE_I2CADDR (0x50)
+#define EE_SIZE (256)
+#define EE_PAGESIZE (8)
+
+#define I2C_AA (1 << 2)
+#define I2C_SI (1 << 3)
+#define I2C_STO (1 << 4)
+#define I2C_STA (1 << 5)
+#define I2C_EN (1 << 6)
+
+#define OW_PIN (1 << 7)
+
+// Register storage plus the value last handed out or committed, a difference
+// between the two means the firmware wrote the register
+static volatile uint32_t regs[SIM_NUM_REGS];
+static uint32_t shadow[SIM_NUM_REGS];
+static uint8_t accessed[SIM_NUM_REGS];
+
+// LIVE registers reflect simulated hardware state and are refreshed on every access,
+// writes to WATCHED registers have side effects. All others are plain storage.
+#define REG_LIVE (1 << 0)
+#define REG_WATCHED (1 << 1)
+static const uint8_t regflags[SIM_NUM_REGS] = {
+	[SIM_T0TC] = REG_LIVE,
+	[SIM_T0TCR] = REG_WATCHED,
+	[SIM_T0MCR] = REG_WATCHED,
+	[SIM_T0MR0] = REG_WATCHED,
+	[SIM_T0IR] = REG_LIVE,
+	[SIM_T1TC] = REG_LIVE,
+	[SIM_T1TCR] = REG_WATCHED,
+	[SIM_T1PR] = REG_WATCHED,
+	[SIM_T1MCR] = REG_WATCHED,
+	[SIM_T1MR0] = REG_WATCHED,
+	[SIM_T1IR] = REG_LIVE,
+	[SIM_FIO0DIR] = REG_WATCHED,
+	[SIM_FIO0SET] = REG_WATCHED,
+	[SIM_FIO0CLR] = REG_WATCHED,
+	[SIM_PCON] = REG_WATCHED,
+	[SIM_PLLSTAT] = REG_LIVE,
+	[SIM_RSIR] = REG_LIVE,
+	[SIM_FIO0PIN] = REG_LIVE,
+	[SIM_IOPIN0] = REG_LIVE,
+	[SIM_FIO1PIN] = REG_LIVE,
+	[SIM_AD0DR1] = REG_LIVE,
+	[SIM_AD0DR2] = REG_LIVE,
+	[SIM_I20CONSET] = REG_LIVE | REG_WATCHED,
+	[SIM_I20CONCLR] = REG_LIVE | REG_WATCHED,
+	[SIM_I20STAT] = REG_LIVE,
+	[SIM_U0IER] = REG_WATCHED,
+	[SIM_U0IIR] = REG_LIVE,
+	[SIM_U0RBR] = REG_LIVE,
+	[SIM_U0THR] = REG_WATCHED,
+};
+
+// Recently accessed watched registers. Writes through the pointer returned by
+// Sim_Reg happen after it returns so they are picked up on later accesses. An
+// entry stays around for a few accesses as the compiler is free to evaluate
+// the register on the left of "T0MR0 = T0TC + x" first.
+#define WATCH_SLOTS (4)
+#define WATCH_ACCESSES (3)
+static uint8_t watchreg[WATCH_SLOTS];
+static uint8_t watchleft[WATCH_SLOTS];
+static uint8_t numwatch = 0;
+
+static uint64_t simticks = 0;
+static uint64_t t0base = 0;
+static uint64_t endticks = 0;
+static uint64_t t0match = UINT64_MAX;
+static uint64_t t1base = 0;
+static uint32_t t1start = 0; // Timer1 count at t1base
+static uint32_t t1div = 1;
+static uint8_t t1running = 0;
+static uint64_t t1match = UINT64_MAX;
+static uint64_t nextevent = 0; // Time of the next MR0 match of either timer or the end of the run
+static uint8_t irqraised = 0;
+static int realtime = 0;
+static struct timeval wallstart;
+
+static int stdinopen = 1;
+static uint8_t rxready = 0;
+static uint8_t rxchar = 0;
+static uint64_t nextrxticks = 0;
+static uint8_t threpending = 0; // Transmission is instantaneous, THR is empty right after a write
+
+static uint8_t i2ccon = 0;
+static uint8_t i2cstat = 0xf8;
+static uint8_t i2cstarted = 0;
+static uint64_t i2cdone = UINT64_MAX; // Bus operation in progress is over and SI gets set
+static uint8_t i2cnextstat;
+static uint8_t i2crxdata;
+static uint8_t i2cslave = 0; // Slave addressed by the current transfer, 0 if none
+static uint8_t eeaddrnext = 0; // Next written byte sets the EEPROM address pointer
+static uint8_t eeptr = 0;
+static uint8_t eeprom[EE_SIZE];
+static uint8_t eedirty = 0;
+static const char* eefile = NULL;
+
+static uint32_t fio0latch = 0; // Output levels set through FIO0SET/FIO0CLR
+
+static uint32_t adcdither = 12345;
+
+// Thermal model is brought up to date when the ADC is sampled
+#define OVEN_MIN_UPDATE_TICKS ((uint64_t)(SIM_TICKS_PER_SEC / 1000))
+static Oven_t oven;
+static uint64_t oventicks = 0;
+
+uint8_t Sim_PartRev = 0x02; // Rev B
+
+uint64_t Sim_GetTicks(void) {
+	return simticks;
+}
+
+double Sim_GetSeconds(void) {
+	return (double)simticks / SIM_TICKS_PER_SEC;
+}
+
+static double WallSeconds(void) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (double)(now.tv_sec - wallstart.tv_sec) + (double)(now.tv_usec - wallstart.tv_usec) * 1e-6;
+}
+
+static uint32_t Timer0_Count(void) {
+	return (uint32_t)(simticks - t0base);
+}
+
+// Timer1 runs straight off PCLK with T1PR at 0, that's TIMER_PRESCALER counts per tick
+static uint32_t Timer1_Count(void) {
+	if (!t1running) {
+		return t1start;
+	}
+	return t1start + (uint32_t)((simticks - t1base) * TIMER_PRESCALER / t1div);
+}
+
+// Restarts the count from the current value, needed before changing speed or stopping
+static void Timer1_Rebase(void) {
+	t1start = Timer1_Count();
+	t1base = simticks;
+}
+
+// Has to be called whenever timer match setup changes
+static void Sim_UpdateNextEvent(void) {
+	t0match = t1match = UINT64_MAX;
+	if (shadow[SIM_T0MCR] & 1) {
+		uint32_t tomatch = shadow[SIM_T0MR0] - Timer0_Count();
+		t0match = simticks + (tomatch ? tomatch : (1ULL << 32));
+	}
+	if (t1running && (shadow[SIM_T1MCR] & 1)) {
+		// First tick where the count reaches the match value
+		uint32_t tomatch = shadow[SIM_T1MR0] - Timer1_Count();
+		uint64_t target = (simticks - t1base) * TIMER_PRESCALER / t1div + (tomatch ? tomatch : (1ULL << 32));
+		t1match = t1base + (target * t1div + TIMER_PRESCALER - 1) / TIMER_PRESCALER;
+	}
+	nextevent = endticks;
+	if (t0match < nextevent) nextevent = t0match;
+	if (t1match < nextevent) nextevent = t1match;
+	if (i2cdone < nextevent) nextevent = i2cdone;
+}
+
+// Virtual time at which the simulation exits, overrides SIM_SECONDS
+void Sim_SetDuration(double seconds) {
+	endticks = (uint64_t)(seconds * SIM_TICKS_PER_SEC);
+	Sim_UpdateNextEvent();
+}
+
+static void I2C_Interrupt(void);
+
+// Moves virtual time forward, raising the MR0 match and I2C interrupts that are passed
+static void Sim_AdvanceTo(uint64_t ticks) {
+	while (ticks >= nextevent) {
+		simticks = nextevent;
+		if (simticks >= endticks) {
+			fflush(stdout);
+			fprintf(stderr, "\nsim: stopped after %.1f virtual seconds (%.3f s wall time)\n",
+			        Sim_GetSeconds(), WallSeconds());
+			exit(0);
+		}
+		if (simticks == t0match) {
+			VIC_Raise(VIC_TIMER0);
+		}
+		if (simticks == t1match) {
+			VIC_Raise(VIC_TIMER1);
+		}
+		if (simticks == i2cdone) {
+			I2C_Interrupt();
+		}
+		irqraised = 1;
+		Sim_UpdateNextEvent();
+	}
+	if (ticks > simticks) {
+		simticks = ticks;
+	}
+}
+
+// Returns 1 if a character from stdin is available within the given wall time
+static int Sim_StdinReady(double timeout) {
+	if (!stdinopen) {
+		if (timeout > 0.0) {
+			usleep((useconds_t)(timeout * 1e6));
+		}
+		return 0;
+	}
+	fd_set fds;
+	struct timeval tv;
+	FD_ZERO(&fds);
+	FD_SET(STDIN_FILENO, &fds);
+	if (timeout < 0.0) timeout = 0.0;
+	tv.tv_sec = (time_t)timeout;
+	tv.tv_usec = (suseconds_t)((timeout - (double)tv.tv_sec) * 1e6);
+	return select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+static void UART_Interrupt(void) {
+	VIC_Raise(VIC_UART0);
+	irqraised = 1;
+}
+
+static void Sim_ReceiveChar(void) {
+	if (read(STDIN_FILENO, &rxchar, 1) == 1) {
+		rxready = 1;
+		nextrxticks = simticks + SIM_UART_CHAR_TICKS;
+		UART_Interrupt();
+	} else {
+		stdinopen = 0;
+	}
+}
+
+// Core is in idle mode until the next interrupt, skip ahead to it
+static void Sim_Idle(void) {
+	uint64_t wake = nextevent;
+
+	if (VIC_IsPending()) {
+		return; // Raised while IRQs were masked, wakes the core right away
+	}
+
+	if (realtime) {
+		fflush(stdout); // Whoever is on the other end of a pipe is waiting for it
+		double timeout = (double)wake / SIM_TICKS_PER_SEC - WallSeconds();
+		if (!rxready && Sim_StdinReady(timeout)) {
+			uint64_t now = (uint64_t)(WallSeconds() * SIM_TICKS_PER_SEC);
+			Sim_AdvanceTo(now < wake ? now : wake);
+			Sim_ReceiveChar();
+			return;
+		}
+	} else if (!rxready && wake > nextrxticks && Sim_StdinReady(0.0)) {
+		Sim_AdvanceTo(nextrxticks);
+		Sim_ReceiveChar();
+		return;
+	}
+	Sim_AdvanceTo(wake);
+}
+
+/*
+ * I2C bus operations take as many SCL periods as they have bits (plus ACK),
+ * SI is set with the new state when they're done. Like the real interface,
+ * STA and STO set while SI is set only take effect when SI is cleared.
+ */
+static uint64_t I2C_Ticks(int bits) {
+	uint32_t period = regs[SIM_I20SCLL] + regs[SIM_I20SCLH]; // PCLKs
+	return ((uint64_t)bits * period + TIMER_PRESCALER - 1) / TIMER_PRESCALER;
+}
+
+static void I2C_Busy(uint8_t stat, int bits) {
+	i2cnextstat = stat;
+	i2cdone = simticks + I2C_Ticks(bits);
+	Sim_UpdateNextEvent();
+}
+
+static void I2C_Interrupt(void) {
+	i2cdone = UINT64_MAX;
+	i2cstat = i2cnextstat;
+	i2ccon |= I2C_SI;
+	if (i2cstat == 0x50 || i2cstat == 0x58) {
+		regs[SIM_I20DAT] = shadow[SIM_I20DAT] = i2crxdata;
+	}
+	regs[SIM_I20CONSET] = shadow[SIM_I20CONSET] = i2ccon;
+	VIC_Raise(VIC_I2C0);
+}
+
+// The byte in I2DAT goes out on the bus
+static void I2C_Transmit(uint8_t data) {
+	if (i2cslave == SPIBRIDGE_I2CADDR) {
+		SPIBridge_Write(data);
+	} else if (i2cslave == EE_I2CADDR) {
+		if (eeaddrnext) {
+			eeptr = data;
+			eeaddrnext = 0;
+		} else {
+			// Page write wraps around within the page just like the real thing
+			eeprom[eeptr] = data;
+			eeptr = (eeptr & ~(EE_PAGESIZE - 1)) | ((eeptr + 1) & (EE_PAGESIZE - 1));
+			eedirty = 1;
+		}
+	}
+	I2C_Busy(0x28, 9);
+}
+
+// Current slave is done, either through a stop or a repeated start
+static void I2C_Release(void) {
+	if (i2cslave == SPIBRIDGE_I2CADDR) {
+		SPIBridge_Stop(simticks);
+	}
+	i2cslave = 0;
+}
+
+static void I2C_Start(void) {
+	I2C_Release();
+	I2C_Busy(i2cstarted ? 0x10 : 0x08, 1);
+	i2cstarted = 1;
+}
+
+static void I2C_Stop(void) {
+	I2C_Release();
+	i2cstarted = 0;
+	i2cstat = 0xf8;
+	i2ccon &= ~I2C_STO;
+}
+
+// Interface disabled through I2EN
+static void I2C_Reset(void) {
+	I2C_Stop();
+	i2ccon = 0;
+	i2cdone = UINT64_MAX;
+	Sim_UpdateNextEvent();
+}
+
+// Firmware cleared SI, carry out whatever comes next in the current state
+static void I2C_Continue(void) {
+	uint8_t data = regs[SIM_I20DAT];
+	if (i2ccon & I2C_STO) {
+		I2C_Stop();
+	}
+	if (i2ccon & I2C_STA) {
+		I2C_Start();
+		return;
+	}
+	switch (i2cstat) {
+		case 0x08: // (Repeated) start sent, I2DAT holds the slave address
+		case 0x10:
+			if ((data >> 1) == EE_I2CADDR) {
+				i2cslave = data >> 1;
+				eeaddrnext = !(data & 1);
+				I2C_Busy((data & 1) ? 0x40 : 0x18, 9);
+			} else if ((data >> 1) == SPIBRIDGE_I2CADDR && SPIBridge_Address(simticks + I2C_Ticks(9), data & 1)) {
+				i2cslave = data >> 1;
+				I2C_Busy((data & 1) ? 0x40 : 0x18, 9);
+			} else {
+				i2cslave = 0; // Nobody else on the simulated bus
+				I2C_Busy((data & 1) ? 0x48 : 0x20, 9);
+			}
+			break;
+		case 0x18:
+		case 0x28:
+			I2C_Transmit(data);
+			break;
+		case 0x40:
+		case 0x50:
+			i2crxdata = (i2cslave == SPIBRIDGE_I2CADDR) ? SPIBridge_Read() : eeprom[eeptr++];
+			I2C_Busy((i2ccon & I2C_AA) ? 0x50 : 0x58, 9);
+			break;
+		default: // Only start or stop are valid after a NACK
+			break;
+	}
+}
+
+const Oven_t* Sim_GetOven(void) {
+	uint64_t elapsed = simticks - oventicks;
+	if (elapsed >= OVEN_MIN_UPDATE_TICKS) {
+		Oven_Step(&oven, Sim_GetHeater(), Sim_GetFan(), (float)((double)elapsed / SIM_TICKS_PER_SEC));
+		oventicks = simticks;
+	}
+	return &oven;
+}
+
+// AD0DRx with the DONE bit set. The thermocouple amplifier gives one degree per
+// LSB relative to the cold junction, which sits at the ambient temperature.
+// Without a 1-wire sensor the firmware assumes that to be 25C.
+static uint32_t ADC_Sample(uint32_t ch) {
+	const Oven_t* o = Sim_GetOven();
+	adcdither = adcdither * 1103515245 + 12345;
+	float value = Oven_GetTC(o, ch - 1) - o->p.ambient + (float)(adcdither >> 16) / 65536.0f;
+	int32_t code = (int32_t)value;
+	if (code < 0) code = 0;
+	if (code > 1023) code = 1023;
+	return (1U << 31) | (ch << 24) | ((uint32_t)code << 6);
+}
+
+// Register was accessed, refresh everything that reflects hardware state
+static void Sim_Prepare(SimReg_t reg) {
+	uint32_t value;
+	switch (reg) {
+		case SIM_T0TC: value = Timer0_Count(); break;
+		case SIM_T0IR: value = 0; break;
+		case SIM_T1TC: value = Timer1_Count(); break;
+		case SIM_T1IR: value = 0; break;
+		case SIM_PLLSTAT: value = (1 << 10); break; // Locked
+		case SIM_RSIR: value = (1 << 0); break; // Power on reset
+		case SIM_FIO0PIN: // All inputs idle high and no keys pressed, the 1-wire bus is modelled
+		case SIM_IOPIN0: value = OWBus_Sample(simticks) ? 0xffffffff : ~OW_PIN; break;
+		case SIM_FIO1PIN: value = 0; break; // LCD never busy
+		case SIM_AD0DR1: value = ADC_Sample(1); break;
+		case SIM_AD0DR2: value = ADC_Sample(2); break;
+		case SIM_I20CONSET: value = i2ccon; break;
+		case SIM_I20CONCLR: value = 0; break;
+		case SIM_I20STAT: value = i2cstat; break;
+		case SIM_U0IIR:
+			// Receive data has priority, reading the THRE identification clears it
+			value = rxready ? 0x04 : threpending ? 0x02 : 0x01;
+			if (value == 0x02) {
+				threpending = 0;
+			}
+			break;
+		case SIM_U0RBR:
+			value = rxchar;
+			rxready = 0;
+			if (threpending) {
+				UART_Interrupt(); // Still pending behind the receive data
+			}
+			break;
+		default: return;
+	}
+	regs[reg] = shadow[reg] = value;
+}
+
+// The firmware wrote a new value to the register
+static void Sim_Write(SimReg_t reg, uint32_t value) {
+	switch (reg) {
+		case SIM_PCON:
+			if (value & 1) {
+				Sim_Idle();
+			}
+			regs[reg] = shadow[reg] = 0; // Cleared again on wake-up
+			break;
+		case SIM_T0TCR:
+			if (value & 2) {
+				t0base = simticks;
+			}
+			Sim_UpdateNextEvent();
+			break;
+		case SIM_T0MCR:
+		case SIM_T0MR0:
+			Sim_UpdateNextEvent();
+			break;
+		case SIM_T1TCR:
+			Timer1_Rebase();
+			if (value & 2) {
+				t1start = 0;
+			}
+			t1running = (value & 3) == 1;
+			Sim_UpdateNextEvent();
+			break;
+		case SIM_T1PR:
+			Timer1_Rebase();
+			t1div = value + 1;
+			Sim_UpdateNextEvent();
+			break;
+		case SIM_T1MCR:
+		case SIM_T1MR0:
+			Sim_UpdateNextEvent();
+			break;
+		case SIM_FIO0SET:
+		case SIM_FIO0CLR:
+		case SIM_FIO0DIR:
+			if (reg == SIM_FIO0SET) {
+				fio0latch |= value;
+			} else if (reg == SIM_FIO0CLR) {
+				fio0latch &= ~value;
+			}
+			OWBus_Drive(simticks, (shadow[SIM_FIO0DIR] & OW_PIN) && !(fio0latch & OW_PIN));
+			break;
+		case SIM_I20CONSET:
+			i2ccon |= value;
+			if (!(i2ccon & I2C_SI)) { // Otherwise deferred until SI is cleared
+				if (value & I2C_STO) {
+					I2C_Stop();
+				} else if ((value & I2C_STA) && !i2cstarted && i2cdone == UINT64_MAX) {
+					I2C_Start();
+				}
+			}
+			regs[reg] = shadow[reg] = i2ccon;
+			break;
+		case SIM_I20CONCLR:
+			if (value & I2C_EN) {
+				I2C_Reset();
+			} else if ((value & I2C_SI) && (i2ccon & I2C_SI)) {
+				i2ccon &= ~value;
+				I2C_Continue();
+			} else {
+				i2ccon &= ~value;
+			}
+			regs[reg] = shadow[reg] = 0;
+			break;
+		case SIM_U0THR:
+			putchar(value);
+			if (shadow[SIM_U0IER] & (1 << 1)) {
+				threpending = 1;
+				UART_Interrupt();
+			}
+			break;
+		case SIM_U0IER:
+			threpending = (value & (1 << 1)) ? 1 : 0;
+			if (threpending) {
+				UART_Interrupt();
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+static inline void Sim_Commit(SimReg_t reg) {
+	if (regs[reg] != shadow[reg]) {
+		shadow[reg] = regs[reg];
+		Sim_Write(reg, shadow[reg]);
+	} else if (accessed[reg] && (reg == SIM_U0THR || reg == SIM_FIO0SET || reg == SIM_FIO0CLR)) {
+		Sim_Write(reg, shadow[reg]); // Repeated characters or pin writes are writes too
+	}
+	accessed[reg] = 0;
+}
+
+void Sim_Sync(void) {
+	uint8_t lp = 0;
+	while (lp < numwatch) {
+		Sim_Commit(watchreg[lp]);
+		if (--watchleft[lp] == 0) {
+			numwatch--;
+			watchreg[lp] = watchreg[numwatch];
+			watchleft[lp] = watchleft[numwatch];
+		} else {
+			lp++;
+		}
+	}
+}
+
+static void Sim_Watch(SimReg_t reg) {
+	uint8_t lp;
+	for (lp = 0; lp < numwatch; lp++) {
+		if (watchreg[lp] == reg) break;
+	}
+	if (lp == WATCH_SLOTS) { // All in use, the oldest one has been committed enough
+		lp = 0;
+		for (uint8_t i = 1; i < numwatch; i++) {
+			if (watchleft[i] < watchleft[lp]) lp = i;
+		}
+	} else if (lp == numwatch) {
+		numwatch++;
+	}
+	watchreg[lp] = reg;
+	watchleft[lp] = WATCH_ACCESSES;
+	accessed[reg] = 1;
+}
+
+volatile uint32_t* Sim_Reg(SimReg_t reg) {
+	if (numwatch) {
+		Sim_Sync();
+	}
+	if (simticks + SIM_ACCESS_TICKS >= nextevent) {
+		Sim_AdvanceTo(simticks + SIM_ACCESS_TICKS);
+	} else {
+		simticks += SIM_ACCESS_TICKS;
+	}
+	if (irqraised) {
+		irqraised = 0;
+		VIC_Dispatch();
+	}
+
+	if (regflags[reg] & REG_LIVE) {
+		Sim_Prepare(reg);
+	}
+	if (regflags[reg] & REG_WATCHED) {
+		Sim_Watch(reg);
+	}
+	return &regs[reg];
+}
+
+// PWM output pins are active low, PWM function disabled means fully on
+static float PWM_Duty(uint32_t pinselbit, SimReg_t matchreg) {
+	if (!(regs[SIM_PWMTCR] & 1)) {
+		return 0.0f;
+	}
+	if (!(regs[SIM_PINSEL0] & pinselbit)) {
+		return 1.0f;
+	}
+	uint32_t match = regs[matchreg];
+	return match >= 0xff ? 0.0f : (float)(0xff - match) / 255.0f;
+}
+
+float Sim_GetHeater(void) {
+	return PWM_Duty(2 << 18, SIM_PWMMR6);
+}
+
+float Sim_GetFan(void) {
+	return PWM_Duty(2 << 16, SIM_PWMMR4);
+}
+
+void Sim_IAP(unsigned int command[], unsigned int result[]) {
+	result[0] = 0; // CMD_SUCCESS
+	if (command[0] == 54) { // Read part ID
+		result[1] = 0x0002ff12; // LPC2134
+	} else if (command[0] == 57) { // Reinvoke ISP
+		fprintf(stderr, "\nsim: ISP mode requested\n");
+		exit(0);
+	}
+}
+
+static void Sim_Exit(void) {
+	if (eefile && eedirty) {
+		FILE* f = fopen(eefile, "wb");
+		if (f) {
+			fwrite(eeprom, 1, sizeof(eeprom), f);
+			fclose(f);
+		} else {
+			fprintf(stderr, "\nsim: unable to save EEPROM to %s\n", eefile);
+		}
+	}
+}
+
+static void __attribute__ ((constructor)) Sim_Init(void) {
+	const char* env;
+	double seconds = SIM_DEFAULT_SECONDS;
+
+	env = getenv("SIM_SECONDS");
+	if (env) {
+		seconds = atof(env);
+	}
+	endticks = (uint64_t)(seconds * SIM_TICKS_PER_SEC);
+	nextevent = endticks;
+
+	env = getenv("SIM_REALTIME");
+	realtime = env && atoi(env);
+
+	memset(eeprom, 0xff, sizeof(eeprom)); // Erased
+	eefile = getenv("SIM_EEPROM");
+	if (eefile) {
+		FILE* f = fopen(eefile, "rb");
+		if (f) {
+			if (fread(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom)) {
+				fprintf(stderr, "\nsim: short EEPROM image in %s\n", eefile);
+			}
+			fclose(f);
+		}
+	}
+	OvenParams_t params;
+	Oven_DefaultParams(&params);
+	if (Oven_ParseParams(&params, getenv("SIM_OVEN"))) {
+		exit(1);
+	}
+	Oven_Init(&oven, &params);
+	if (OWBus_Init(getenv("SIM_ONEWIRE"))) {
+		exit(1);
+	}
+	if (SPIBridge_Init(getenv("SIM_SPITC"))) {
+		exit(1);
+	}
+
+	atexit(Sim_Exit);
+	gettimeofday(&wallstart, NULL);
+}
@@ -0,0 +1,48 @@
+/*
+ * sim.h - Host-side simulation of the T-962 controller hardware
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include "vic.h"
+#include "oven.h"
+
+// Simulated time is kept in Timer0 ticks
+#define SIM_TICKS_PER_SEC ((double)PCLKFREQ / TIMER_PRESCALER)
+
+// Commits register writes that haven't been seen yet, see Sim_Reg
+void Sim_Sync(void);
+uint64_t Sim_GetTicks(void);
+double Sim_GetSeconds(void);
+void Sim_SetDuration(double seconds);
+
+// Current PWM duty cycle of the heater and fan outputs, 0.0 - 1.0
+float Sim_GetHeater(void);
+float Sim_GetFan(void);
+
+// Thermal model state, brought up to date with the current heater and fan outputs
+const Oven_t* Sim_GetOven(void);
+
+// Simulated interrupt controller, in vic_sim.c
+void VIC_Raise(VICInt_t num);
+uint32_t VIC_IsPending(void);
+void VIC_Dispatch(void);
+
+#endif /* SIM_H_ */
@@ -0,0 +1,169 @@
+/*
+ * spibridge.c - Simulated SC18IS602B I2C to SPI bridge with MAX31855 slaves
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "t962.h"
+#include "sched.h"
+#include "sim.h"
+#include "spibridge.h"
+
+/*
+ * The bridge buffers what's written to it, a function ID of 0x01-0x0f sends
+ * the rest out on SPI with those slave selects low once the write is stopped.
+ * It doesn't acknowledge its address until the SPI transfer is over, after
+ * that reading returns the data clocked in from MISO.
+ *
+ * A MAX31855 converts continuously while its CS is high, a conversion takes
+ * 100ms and pulling CS low early aborts it and returns the previous result.
+ *
+ * SIM_SPITC lists what's on slave selects 0-3, for example "max31855,max31855".
+ * "none" leaves a slave select unused, appending ":oc", ":scg" or ":scv" to a
+ * MAX31855 makes it report an open thermocouple or one shorted to GND or VCC.
+ * Thermocouple N reads channel N of the oven model.
+ */
+
+#define SPI_TICKS(bits, hz) ((uint64_t)((double)(bits) * SIM_TICKS_PER_SEC / (hz)))
+#define MAX31855_CONV_TICKS ((uint64_t)(SIM_TICKS_PER_SEC * 0.1))
+
+#define SB_NUM_SS (4)
+#define SB_BUFSIZE (200)
+
+typedef struct {
+	uint8_t present;
+	uint8_t faults; // D2-D0 of the MAX31855 frame
+	uint32_t frame; // Result of the last finished conversion
+	uint64_t cshigh; // Conversion started
+} MAX31855_t;
+
+static int present = 0;
+static MAX31855_t tcs[SB_NUM_SS];
+static const uint32_t spiclks[] = { 1843000, 461000, 115000, 58000 };
+static uint8_t spiconfig = 0;
+static uint8_t buf[SB_BUFSIZE + 1]; // Function ID and data
+static int buflen = 0;
+static int readpos = 0;
+static uint64_t busyuntil = 0;
+
+static uint32_t MAX31855_Frame(const MAX31855_t* m, uint8_t ss) {
+	const Oven_t* o = Sim_GetOven();
+	uint32_t frame = ((uint32_t)(int32_t)(o->p.ambient * 16.0f) & 0xfff) << 4;
+	if (m->faults) {
+		frame |= (1 << 16) | m->faults;
+	} else {
+		frame |= ((uint32_t)(int32_t)(Oven_GetTC(o, ss) * 4.0f) & 0x3fff) << 18;
+	}
+	return frame;
+}
+
+// SPI transfer of the buffered data with the given slave selects low
+static void SPIBridge_Transfer(uint64_t ticks, uint8_t ssmask) {
+	int numbytes = buflen - 1;
+	uint32_t frame = 0xffffffff; // MISO pulled up if nobody drives it
+	uint64_t done = ticks + SPI_TICKS(numbytes * 8, spiclks[spiconfig & 3]);
+	for (int i = 0; i < SB_NUM_SS; i++) {
+		MAX31855_t* m = &tcs[i];
+		if (!(ssmask & (1 << i)) || !m->present) continue;
+		if (ticks - m->cshigh >= MAX31855_CONV_TICKS) {
+			m->frame = MAX31855_Frame(m, i);
+		}
+		m->cshigh = done;
+		frame &= m->frame;
+	}
+	for (int i = 0; i < numbytes; i++) {
+		buf[i] = i < 4 ? frame >> (24 - 8 * i) : 0;
+	}
+	busyuntil = done;
+}
+
+// Returns 1 if the address is acknowledged
+int SPIBridge_Address(uint64_t ticks, int read) {
+	if (!present || ticks < busyuntil) {
+		return 0;
+	}
+	if (read) {
+		readpos = 0;
+	} else {
+		buflen = 0;
+	}
+	return 1;
+}
+
+void SPIBridge_Write(uint8_t data) {
+	if (buflen < sizeof(buf)) {
+		buf[buflen++] = data;
+	}
+}
+
+uint8_t SPIBridge_Read(void) {
+	return readpos < SB_BUFSIZE ? buf[readpos++] : 0xff;
+}
+
+// End of a transfer, carries out what was written
+void SPIBridge_Stop(uint64_t ticks) {
+	if (buflen == 0) {
+		return;
+	}
+	if (buf[0] >= 0x01 && buf[0] <= 0x0f) {
+		SPIBridge_Transfer(ticks, buf[0]);
+	} else if (buf[0] == 0xf0 && buflen > 1) {
+		spiconfig = buf[1];
+	}
+	buflen = 0;
+}
+
+// Sets up the slaves from a "max31855,none,max31855:oc" list, returns -1 on unknown names
+int32_t SPIBridge_Init(const char* config) {
+	int ss = 0;
+	present = (config != NULL);
+	memset(tcs, 0, sizeof(tcs));
+	while (config && *config) {
+		size_t len = strcspn(config, ",");
+		size_t namelen = strcspn(config, ",:");
+		if (ss == SB_NUM_SS) {
+			fprintf(stderr, "\nspibridge: too many devices");
+			return -1;
+		}
+		if (namelen == 8 && !strncmp(config, "max31855", namelen)) {
+			tcs[ss].present = 1;
+			const char* fault = config + namelen;
+			if (fault < config + len) {
+				if (!strncmp(fault, ":oc", 3)) {
+					tcs[ss].faults = 1 << 0;
+				} else if (!strncmp(fault, ":scg", 4)) {
+					tcs[ss].faults = 1 << 1;
+				} else if (!strncmp(fault, ":scv", 4)) {
+					tcs[ss].faults = 1 << 2;
+				} else {
+					fprintf(stderr, "\nspibridge: unknown fault '%.*s'", (int)(config + len - fault), fault);
+					return -1;
+				}
+			}
+		} else if (!(len == 4 && !strncmp(config, "none", len))) {
+			fprintf(stderr, "\nspibridge: unknown device '%.*s'", (int)len, config);
+			return -1;
+		}
+		ss++;
+		config += len;
+		if (*config == ',') config++;
+	}
+	return 0;
+}
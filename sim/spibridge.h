@@ -0,0 +1,33 @@
+/*
+ * spibridge.h - Simulated SC18IS602B I2C to SPI bridge with MAX31855 slaves
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPIBRIDGE_H_
+#define SPIBRIDGE_H_
+
+#include <stdint.h>
+
+#define SPIBRIDGE_I2CADDR (0x28)
+
+int32_t SPIBridge_Init(const char* config);
+int SPIBridge_Address(uint64_t ticks, int read);
+void SPIBridge_Write(uint8_t data);
+uint8_t SPIBridge_Read(void);
+void SPIBridge_Stop(uint64_t ticks);
+
+#endif /* SPIBRIDGE_H_ */
@@ -0,0 +1,201 @@
+/*
+ * pidequiv.c - Checks the fixed point PID controller against the float one
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "PID_v1.h"
+#include "reflow.h"
+#include "sensor.h"
+#include "pidref.h"
+
+/*
+ * Feeds the same setpoint and input sequences to the Q16.16 controller the
+ * firmware runs and to the float build of the same code (pidref.c), for a few
+ * sets of gains, and compares the outputs after every PID_Compute. Exits with
+ * 1 if they ever differ by more than PIDEQUIV_TOLERANCE output counts.
+ *
+ * The calls are made the way reflow.c makes them: PID_TIMEBASE sample time,
+ * 0 - 255+248 output range shifted by the heater feedforward, inputs in
+ * 1/SENSOR_TEMP_SCALE degC and bumpless restarts on mode changes. The inputs
+ * come from a first order oven driven by the float controller's output, with
+ * some measurement noise, so both see realistic closed loop sequences.
+ */
+
+// A tenth of a heater/fan PWM step. Rounding alone stays around 0.005, losing
+// precision anywhere (as a Q16.16 Ki did at low gains) shows up well above this.
+#define PIDEQUIV_TOLERANCE (0.1f)
+
+#define OUT_MID (248) // Between fan and heat
+#define OUT_MAX (255 + 248)
+
+typedef struct {
+	float kp, ki, kd;
+} Tuning_t;
+
+static const Tuning_t tunings[] = {
+	{ 20.0f, 0.016f, 62.5f }, // PID_DEFAULT_*
+	{ 10.0f, 0.04f, 0.0f },
+	{ 40.0f, 0.2f, 100.0f },
+	{ 2.0f, 0.001f, 300.0f },
+	{ 200.0f, 2.0f, 600.0f }, // Close to what autotune accepts
+};
+
+static PidType pid;
+static float maxdiff;
+static uint32_t worststep;
+static uint32_t step;
+
+// Simple oven, only has to make the input sequences look like the real thing
+static float oventemp;
+static uint32_t noise;
+
+// Output range shifted by the feedforward, like Reflow_Run does
+static void Equiv_Limits(int32_t feedforward) {
+	PID_SetOutputLimits(&pid, 0 - feedforward, OUT_MAX - feedforward);
+	PIDRef_SetOutputLimits(0 - feedforward, OUT_MAX - feedforward);
+}
+
+static void Equiv_Setup(const Tuning_t* t) {
+	PID_init(&pid, 0, 0, 0, PID_Direction_Direct);
+	PID_SetSampleTime(&pid, PID_TIMEBASE);
+	PID_SetTunings(&pid, t->kp, t->ki, t->kd);
+	PID_SetMode(&pid, PID_Mode_Automatic);
+	PIDRef_Setup(t->kp, t->ki, t->kd, PID_TIMEBASE);
+	Equiv_Limits(0);
+	maxdiff = 0.0f;
+	worststep = 0;
+	step = 0;
+	oventemp = 25.0f;
+	noise = 12345;
+}
+
+static void Equiv_Restart(int32_t input, int32_t output) {
+	PID_SetMode(&pid, PID_Mode_Manual);
+	pid.myInput = PID_FROM_FIXED(input, SENSOR_TEMP_FRACBITS);
+	pid.myOutput = PID_FROM_INT(output);
+	PID_SetMode(&pid, PID_Mode_Automatic);
+	PIDRef_Restart((float)input / SENSOR_TEMP_SCALE, (float)output);
+}
+
+// Current oven reading with up to +-0.5C of noise, quantized like the sensors
+static int32_t Equiv_Measure(void) {
+	noise = noise * 1103515245 + 12345;
+	float n = (float)(noise >> 16) / 65536.0f - 0.5f;
+	return (int32_t)floorf((oventemp + n) * SENSOR_TEMP_SCALE + 0.5f);
+}
+
+// One control tick, returns the float controller's output including the feedforward
+static float Equiv_Step(float setpoint, int32_t input, int32_t feedforward) {
+	pid.mySetpoint = PID_FROM_FLOAT(setpoint);
+	pid.myInput = PID_FROM_FIXED(input, SENSOR_TEMP_FRACBITS);
+	PID_Compute(&pid);
+	float fixed = PID_TO_FLOAT(pid.myOutput);
+	float ref = PIDRef_Compute(setpoint, (float)input / SENSOR_TEMP_SCALE);
+
+	float diff = fabsf(fixed - ref);
+	if (diff > maxdiff) {
+		maxdiff = diff;
+		worststep = step;
+	}
+	step++;
+
+	// Heater above the middle, fan below it cools towards ambient a bit faster
+	float out = ref + feedforward;
+	float heat = out > OUT_MID ? (out - OUT_MID) / 255.0f : 0.0f;
+	float fan = out < OUT_MID ? (OUT_MID - out) / 255.0f : 0.0f;
+	float dt = PID_TIMEBASE / 1000.0f;
+	oventemp += (25.0f + 350.0f * heat - oventemp) * dt / (80.0f - 40.0f * fan);
+	return out;
+}
+
+// Bake style step from ambient to 150C and later down to 50C
+static void Seq_Step(void) {
+	for (int i = 0; i < 600 * 20; i++) {
+		Equiv_Step(i < 400 * 20 ? 150.0f : 50.0f, Equiv_Measure(), 0);
+	}
+}
+
+// Reflow style ramp with a feedforward following the slope, then cooling
+static void Seq_Ramp(void) {
+	for (int i = 0; i < 360 * 20; i++) {
+		float t = i / 20.0f;
+		float sp = t < 200.0f ? 25.0f + t : t < 240.0f ? 225.0f : 225.0f - (t - 240.0f) * 1.5f;
+		int32_t ff = t < 200.0f ? 100 : 0;
+		Equiv_Limits(ff);
+		Equiv_Step(sp, Equiv_Measure(), ff);
+	}
+}
+
+// Heater not doing anything for two minutes, the integrator must not wind up differently
+static void Seq_Windup(void) {
+	for (int i = 0; i < 300 * 20; i++) {
+		int32_t input = Equiv_Measure();
+		if (i < 120 * 20) {
+			oventemp = 25.0f;
+		}
+		Equiv_Step(240.0f, input, 0);
+	}
+}
+
+// Mode changes restarting the controller from the outputs that were last applied
+static void Seq_Restart(void) {
+	static const int32_t restartout[] = { OUT_MID, OUT_MAX, 0, OUT_MID + 100, OUT_MID - 100 };
+	float out = OUT_MID;
+	for (int i = 0; i < 500 * 20; i++) {
+		int32_t input = Equiv_Measure();
+		if (i % (100 * 20) == 0) {
+			Equiv_Restart(input, i ? (int32_t)out : restartout[0]);
+		} else if (i % (100 * 20) == 50 * 20) {
+			Equiv_Restart(input, restartout[(i / (100 * 20)) % 5]);
+		}
+		out = Equiv_Step(i < 250 * 20 ? 180.0f : 120.0f, input, 0);
+	}
+}
+
+typedef struct {
+	const char* name;
+	void (*run)(void);
+} Sequence_t;
+
+static const Sequence_t sequences[] = {
+	{ "step", Seq_Step },
+	{ "ramp", Seq_Ramp },
+	{ "windup", Seq_Windup },
+	{ "restart", Seq_Restart },
+};
+
+int main(void) {
+	int failed = 0;
+
+	printf("%8s %8s %8s  %-8s %8s %8s\n", "Kp", "Ki", "Kd", "Sequence", "MaxDiff", "AtStep");
+	for (uint32_t t = 0; t < sizeof(tunings) / sizeof(tunings[0]); t++) {
+		for (uint32_t s = 0; s < sizeof(sequences) / sizeof(sequences[0]); s++) {
+			Equiv_Setup(&tunings[t]);
+			sequences[s].run();
+			int bad = maxdiff > PIDEQUIV_TOLERANCE;
+			printf("%8.3f %8.4f %8.1f  %-8s %8.4f %8u%s\n", tunings[t].kp, tunings[t].ki, tunings[t].kd,
+			       sequences[s].name, maxdiff, (unsigned int)worststep, bad ? "  FAIL" : "");
+			failed |= bad;
+		}
+	}
+	printf("Fixed point PID %s the float version within %.2f output counts\n",
+	       failed ? "does NOT match" : "matches", PIDEQUIV_TOLERANCE);
+	return failed;
+}
@@ -0,0 +1,69 @@
+/*
+ * pidref.c - Floating point build of the PID controller, for comparisons
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compiles PID_v1.c a second time without PID_FIXEDPOINT, with every function
+ * renamed so it links next to the fixed point controller the firmware uses.
+ * The PidType of this build is only visible in here.
+ */
+
+#define PID_FLOATINGPOINT
+#define PID_init PIDRef_init
+#define PID_Initialize PIDRef_Initialize
+#define PID_SetMode PIDRef_SetMode
+#define PID_Compute PIDRef_ComputeRaw
+#define PID_SetOutputLimits PIDRef_SetOutputLimitsRaw
+#define PID_SetTunings PIDRef_SetTunings
+#define PID_SetSampleTime PIDRef_SetSampleTime
+#define PID_SetControllerDirection PIDRef_SetControllerDirection
+#define PID_GetKp PIDRef_GetKp
+#define PID_GetKi PIDRef_GetKi
+#define PID_GetKd PIDRef_GetKd
+#define PID_GetMode PIDRef_GetMode
+#define PID_GetDirection PIDRef_GetDirection
+#include "PID_v1.c"
+
+#include "pidref.h"
+
+static PidType ref;
+
+void PIDRef_Setup(float kp, float ki, float kd, int sampletime) {
+	PID_init(&ref, 0, 0, 0, PID_Direction_Direct);
+	PID_SetSampleTime(&ref, sampletime);
+	PID_SetTunings(&ref, kp, ki, kd);
+	PID_SetMode(&ref, PID_Mode_Automatic);
+}
+
+void PIDRef_SetOutputLimits(float min, float max) {
+	PID_SetOutputLimits(&ref, min, max);
+}
+
+void PIDRef_Restart(float input, float output) {
+	PID_SetMode(&ref, PID_Mode_Manual);
+	ref.myInput = input;
+	ref.myOutput = output;
+	PID_SetMode(&ref, PID_Mode_Automatic);
+}
+
+float PIDRef_Compute(float setpoint, float input) {
+	ref.mySetpoint = setpoint;
+	ref.myInput = input;
+	PID_Compute(&ref);
+	return ref.myOutput;
+}
@@ -0,0 +1,30 @@
+/*
+ * pidref.h - Floating point build of the PID controller, for comparisons
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIDREF_H_
+#define PIDREF_H_
+
+// Same sequence of calls the firmware makes: PID_init, PID_SetSampleTime, PID_SetTunings
+void PIDRef_Setup(float kp, float ki, float kd, int sampletime);
+void PIDRef_SetOutputLimits(float min, float max);
+// Manual and back to automatic with the given output, the bumpless transfer Reflow_TrackOutputs does
+void PIDRef_Restart(float input, float output);
+float PIDRef_Compute(float setpoint, float input);
+
+#endif /* PIDREF_H_ */
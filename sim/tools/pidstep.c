@@ -0,0 +1,309 @@
+/*
+ * pidstep.c - Step response and mode switch checks for the reflow PID
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "t962.h"
+#include "sched.h"
+#include "vic.h"
+#include "io.h"
+#include "i2c.h"
+#include "nvstorage.h"
+#include "adc.h"
+#include "onewire.h"
+#include "max31855.h"
+#include "sensor.h"
+#include "reflow.h"
+#include "reflow_profiles.h"
+#include "sim.h"
+#include "oven.h"
+
+/*
+ * Two checks, exits with 1 if either fails:
+ *
+ * Drives the oven model through a step from ambient to 150C and a long ramp
+ * up to 200C, once with the firmware's Reflow_Run() and once with the clamp-only
+ * integrator the PID had before conditional integration (a float copy below),
+ * using the same gains. The firmware must not overshoot more than the old
+ * integrator did, and must settle within STEP_SETTLE_BAND about as quickly.
+ * Holding the integrator while the output is saturated means the setpoint is
+ * approached from below instead of through an overshoot, which can take a bit
+ * longer, hence the STEP_SETTLE_SLACK.
+ *
+ * Runs the whole firmware through the scheduler against the simulated oven and
+ * switches STANDBY -> BAKE -> REFLOW. Standby never heats, so the integrator
+ * has plenty of time to wind up before the switch to bake. The heater/fan output
+ * actually applied must not jump by more than the proportional response to the
+ * new setpoint (plus the profile feedforward when the reflow starts). Kd is
+ * zeroed for this part, the derivative of the quantized readings would only add
+ * noise to what is being measured.
+ */
+
+#define STEP_SECS (PID_TIMEBASE / 1000.0f)
+#define STEP_SETTLE_BAND (2.0f) // degC
+#define STEP_OVERSHOOT_MARGIN (0.25f) // degC, a few sensor LSBs
+#define STEP_SETTLE_SLACK(old) ((old) * 1.1f + 5.0f) // s
+
+// Output jump allowed on top of the proportional response, a couple of integrator
+// steps and PWM rounding
+#define SWITCH_MARGIN (4)
+
+#define OUT_MID (248) // Between fan and heat
+#define OUT_MAX (255 + 248)
+
+typedef struct {
+	float kp, ki, kd;
+} Tuning_t;
+
+// PID_DEFAULT_* never settle on the default oven model (Ki is too low to get rid
+// of the offset within the test), these are gains that do
+static const Tuning_t tunings[] = {
+	{ 20.0f, 0.2f, 62.5f },
+	{ 40.0f, 0.4f, 100.0f },
+};
+
+typedef struct {
+	const char* name;
+	float start; // Setpoint held before the test starts, degC
+	float target;
+	float rate; // degC/s towards target, 0 for a step
+	float holdsecs; // Time after the setpoint has reached target
+} Scenario_t;
+
+static const Scenario_t scenarios[] = {
+	{ "step", 25.0f, 150.0f, 0.0f, 900.0f },
+	{ "ramp", 30.0f, 200.0f, 0.5f, 900.0f },
+};
+
+typedef struct {
+	float overshoot; // degC above target after it has been reached
+	float settle; // s from the setpoint reaching target until staying within the band
+} Response_t;
+
+// The integrator as it was before conditional integration: always integrates,
+// only clamped to the output limits afterwards
+static struct {
+	Tuning_t t;
+	float iterm;
+	float lastinput;
+} clamponly;
+
+static float ClampOnly_Compute(float setpoint, float input) {
+	float error = setpoint - input;
+	clamponly.iterm += clamponly.t.ki * STEP_SECS * error;
+	if (clamponly.iterm > OUT_MAX) {
+		clamponly.iterm = OUT_MAX;
+	} else if (clamponly.iterm < 0.0f) {
+		clamponly.iterm = 0.0f;
+	}
+	float output = clamponly.t.kp * error + clamponly.iterm - (clamponly.t.kd / STEP_SECS) * (input - clamponly.lastinput);
+	clamponly.lastinput = input;
+	if (output > OUT_MAX) {
+		output = OUT_MAX;
+	} else if (output < 0.0f) {
+		output = 0.0f;
+	}
+	return output;
+}
+
+// Same mapping as Reflow_Run
+static void MapOutput(uint32_t out, uint8_t* pheat, uint8_t* pfan) {
+	if (out < OUT_MID) {
+		*pfan = 255 - out;
+		*pheat = 0;
+	} else {
+		*pheat = out - OUT_MID;
+		*pfan = NV_GetConfig(REFLOW_MIN_FAN_SPEED);
+	}
+}
+
+static int32_t Measure(const Oven_t* oven) {
+	float meas = (Oven_GetTC(oven, 0) + Oven_GetTC(oven, 1)) / 2.0f;
+	return (int32_t)floorf(meas * SENSOR_TEMP_SCALE + 0.5f);
+}
+
+static void RunScenario(const Scenario_t* s, const Tuning_t* t, int firmware, Response_t* res) {
+	OvenParams_t params;
+	Oven_t oven;
+	Oven_DefaultParams(&params);
+	Oven_Init(&oven, &params);
+
+	int32_t meas = Measure(&oven);
+	if (firmware) {
+		Reflow_SetTunings(t->kp, t->ki, t->kd);
+		Reflow_ResetPID(meas);
+	} else {
+		clamponly.t = *t;
+		clamponly.iterm = OUT_MID;
+		clamponly.lastinput = (float)meas / SENSOR_TEMP_SCALE;
+	}
+
+	float rampsecs = s->rate > 0.0f ? (s->target - s->start) / s->rate : 0.0f;
+	uint32_t steps = (uint32_t)((rampsecs + s->holdsecs) / STEP_SECS);
+	res->overshoot = 0.0f;
+	res->settle = 0.0f;
+	for (uint32_t i = 0; i < steps; i++) {
+		float t = i * STEP_SECS;
+		int32_t sp = (int32_t)(t < rampsecs ? s->start + s->rate * t : s->target);
+		uint8_t heat, fan;
+		meas = Measure(&oven);
+		if (firmware) {
+			Reflow_Run(0, meas, &heat, &fan, sp);
+		} else {
+			MapOutput((uint32_t)ClampOnly_Compute((float)sp, (float)meas / SENSOR_TEMP_SCALE), &heat, &fan);
+		}
+		Oven_Step(&oven, heat / 255.0f, fan / 255.0f, STEP_SECS);
+
+		if (t >= rampsecs) {
+			float error = (float)meas / SENSOR_TEMP_SCALE - s->target;
+			if (error > res->overshoot) {
+				res->overshoot = error;
+			}
+			if (fabsf(error) > STEP_SETTLE_BAND) {
+				res->settle = t + STEP_SECS - rampsecs;
+			}
+		}
+	}
+}
+
+static int CheckResponses(void) {
+	int failed = 0;
+
+	printf("%8s %8s %8s  %-6s %-10s %9s %9s\n", "Kp", "Ki", "Kd", "Test", "Integrator", "Overshoot", "Settle");
+	for (uint32_t t = 0; t < sizeof(tunings) / sizeof(tunings[0]); t++) {
+		for (uint32_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+			Response_t old, new;
+			RunScenario(&scenarios[i], &tunings[t], 0, &old);
+			RunScenario(&scenarios[i], &tunings[t], 1, &new);
+			int bad = new.overshoot > old.overshoot + STEP_OVERSHOOT_MARGIN ||
+			          new.settle > STEP_SETTLE_SLACK(old.settle) || new.settle >= scenarios[i].holdsecs;
+			printf("%8.3f %8.4f %8.1f  %-6s %-10s %8.2fC %8.1fs\n", tunings[t].kp, tunings[t].ki, tunings[t].kd,
+			       scenarios[i].name, "clamp-only", old.overshoot, old.settle);
+			printf("%8.3f %8.4f %8.1f  %-6s %-10s %8.2fC %8.1fs%s\n", tunings[t].kp, tunings[t].ki, tunings[t].kd,
+			       scenarios[i].name, "firmware", new.overshoot, new.settle, bad ? "  FAIL" : "");
+			failed |= bad;
+		}
+	}
+	return failed;
+}
+
+// Heater/fan output the firmware is applying right now, on the 0 - 255+248 scale of the PID
+static int32_t AppliedOutput(void) {
+	int32_t heat = (int32_t)(Sim_GetHeater() * 255.0f + 0.5f);
+	int32_t fan = (int32_t)(Sim_GetFan() * 255.0f + 0.5f);
+	if (heat > 0) {
+		return OUT_MID + heat;
+	} else if (fan > 255 - OUT_MID) {
+		return 255 - fan;
+	}
+	return OUT_MID;
+}
+
+static uint32_t fastforward = 0;
+
+// Stands in for the UI, Reflow_Work wakes it up regularly while a cycle is running
+static int32_t Idle_Work(void) {
+	return -1;
+}
+
+// Lets the firmware run for a while, the same way main() does
+static void RunFirmware(float secs) {
+	double end = Sim_GetSeconds() + secs;
+	while (Sim_GetSeconds() < end) {
+		fastforward = Sched_Sleep(Sched_Do(fastforward));
+	}
+}
+
+// Switches mode and returns how far the applied output moved, minus what the
+// proportional response to the new setpoint and the feedforward account for
+static int32_t SwitchMode(ReflowMode_t mode, float kp) {
+	int32_t before = AppliedOutput();
+	int32_t meas = Sensor_GetTempFixed(TC_AVERAGE);
+	float setpoint = Reflow_GetSetpoint();
+	int32_t feedforward = 0;
+	if (mode == REFLOW_REFLOW) {
+		setpoint = (float)Reflow_GetProfileSetpoint(0) / PROFILE_TEMP_SCALE;
+		int32_t slope = Reflow_GetProfileSlope(0);
+		if (slope > 0) {
+			feedforward = (slope * NV_GetConfig(REFLOW_FF_GAIN)) >> PROFILE_TEMP_FRACBITS;
+		}
+	}
+	int32_t expected = (int32_t)(kp * fabsf(setpoint - (float)meas / SENSOR_TEMP_SCALE) + 0.5f) + feedforward;
+
+	Reflow_SetMode(mode);
+	RunFirmware(PID_TIMEBASE / 1000.0f); // One control loop run
+	return abs(AppliedOutput() - before) - expected;
+}
+
+static int CheckModeSwitch(void) {
+	static const struct {
+		ReflowMode_t mode;
+		const char* name;
+		uint16_t setpoint; // Bake setpoint set just before switching, like the UI does
+		float secs; // Time spent in this mode before the next switch
+	} sequence[] = {
+		{ REFLOW_BAKE, "STANDBY->BAKE", SETPOINT_MIN, 300.0f },
+		{ REFLOW_REFLOW, "BAKE->REFLOW", 0, 60.0f },
+	};
+	const Tuning_t* t = &tunings[0];
+	int failed = 0;
+
+	Sched_SetWorkfunc(MAIN_WORK, Idle_Work);
+	Sched_SetState(TELEMETRY_WORK, 0, 0); // No need for the serial log
+	Reflow_SetTunings(t->kp, t->ki, 0.0f);
+	Reflow_SelectProfileIdx(0);
+	Reflow_SetBakeTimer(0);
+
+	Reflow_SetMode(REFLOW_STANDBY);
+	RunFirmware(300.0f); // Integrator winds up against the heater standby won't turn on
+
+	printf("\n%-14s %6s\n", "Switch", "Excess");
+	for (uint32_t i = 0; i < sizeof(sequence) / sizeof(sequence[0]); i++) {
+		if (sequence[i].setpoint) {
+			Reflow_SetSetpoint(sequence[i].setpoint);
+		}
+		int32_t excess = SwitchMode(sequence[i].mode, t->kp);
+		int bad = excess > SWITCH_MARGIN;
+		printf("%-14s %6d%s\n", sequence[i].name, (int)excess, bad ? "  FAIL" : "");
+		failed |= bad;
+		RunFirmware(sequence[i].secs);
+	}
+	return failed;
+}
+
+int main(void) {
+	Sim_SetDuration(1e9); // Keep the simulated peripherals running for as long as it takes
+	VIC_Init();
+	Sched_Init();
+	IO_Init();
+	I2C_Init();
+	NV_Init();
+	ADC_Init();
+	OneWire_Init();
+	SPI_TC_Init();
+	Sensor_Init();
+	Reflow_Init(); // The scheduler isn't run until the mode switch checks
+
+	int failed = CheckResponses();
+	failed |= CheckModeSwitch();
+	printf("PID step response and mode switch checks %s\n", failed ? "FAILED" : "passed");
+	return failed;
+}
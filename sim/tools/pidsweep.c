@@ -0,0 +1,340 @@
+/*
+ * pidsweep.c - Batch PID gain sweep over the built-in reflow profiles
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "t962.h"
+#include "sched.h"
+#include "vic.h"
+#include "i2c.h"
+#include "nvstorage.h"
+#include "sensor.h"
+#include "reflow.h"
+#include "reflow_profiles.h"
+#include "sim.h"
+#include "oven.h"
+
+/*
+ * Runs the firmware's own Reflow_Run() and PID_Compute() against the oven model
+ * for every combination of Kp/Ki/Kd and feedforward gain on the grid and every
+ * profile, then ranks the gains. Each run starts from a cold oven with the PID reset at ambient.
+ *
+ * All metrics are taken from the averaged thermocouple reading the controller
+ * sees, against the interpolated setpoint:
+ *  RMS       root mean square tracking error
+ *  Overshoot largest excursion above the setpoint
+ *  Peak      difference between the measured and the profile peak
+ *  TAL       difference in time above liquidus, the liquidus being taken as
+ *            LIQUIDUS_BELOW_PEAK under the profile peak which is close enough
+ *            for the built-in alloys
+ * The score is RMS + Overshoot + Peak + TAL/10, lower is better.
+ */
+
+#define LIQUIDUS_BELOW_PEAK (30.0f)
+#define TAL_WEIGHT (0.1f)
+#define STEP_SECS (PID_TIMEBASE / 1000.0f)
+
+typedef struct {
+	float start, stop, step;
+} Range_t;
+
+typedef struct {
+	uint32_t combo;
+	int32_t profile;
+	float kp, ki, kd, ff;
+	float rms, overshoot, peak, tal, score;
+} Result_t;
+
+static OvenParams_t ovenparams;
+
+static uint32_t RangeCount(const Range_t* r) {
+	if (r->step <= 0.0f || r->stop < r->start) {
+		return 1;
+	}
+	return (uint32_t)((r->stop - r->start) / r->step + 1.5f);
+}
+
+static float RangeValue(const Range_t* r, uint32_t i) {
+	return r->start + r->step * (float)i;
+}
+
+static int ParseRange(const char* str, Range_t* r) {
+	int n = sscanf(str, "%f:%f:%f", &r->start, &r->stop, &r->step);
+	if (n == 1) {
+		r->stop = r->start;
+		r->step = 0.0f;
+	} else if (n != 3) {
+		fprintf(stderr, "Invalid range '%s', expected start:stop:step\n", str);
+		return -1;
+	}
+	return 0;
+}
+
+// A profile is usable if it has at least two setpoints and none out of range (erased EEPROM)
+static int ProfilePeak(int32_t profile, float* peak) {
+	int count = 0;
+	*peak = 0.0f;
+	Reflow_SelectProfileIdx(profile);
+	for (int i = 0; i < NUMPROFILETEMPS; i++) {
+		uint16_t value = Reflow_GetSetpointAtIdx(i);
+		if (value == 0) break;
+		if (value > SETPOINT_MAX) return 0;
+		if (value > *peak) *peak = value;
+		count++;
+	}
+	return count >= 2;
+}
+
+static void RunProfile(Result_t* res) {
+	Oven_t oven;
+	float profilepeak, measpeak = 0.0f;
+	float sumsq = 0.0f, overshoot = 0.0f;
+	uint32_t steps = 0, talsp = 0, talmeas = 0;
+
+	ProfilePeak(res->profile, &profilepeak);
+	float liquidus = profilepeak - LIQUIDUS_BELOW_PEAK;
+
+	Oven_Init(&oven, &ovenparams);
+	Reflow_SetTunings(res->kp, res->ki, res->kd);
+	NV_SetConfig(REFLOW_FF_GAIN, (uint8_t)res->ff);
+	Reflow_ResetPID((int32_t)(ovenparams.ambient * SENSOR_TEMP_SCALE));
+
+	while (1) {
+		uint8_t heat, fan;
+		float meas = (Oven_GetTC(&oven, 0) + Oven_GetTC(&oven, 1)) / 2.0f;
+		if (Reflow_Run(steps * PID_TIMEBASE, (int32_t)(meas * SENSOR_TEMP_SCALE), &heat, &fan, 0)) {
+			break;
+		}
+		float sp = Reflow_GetSetpoint();
+		float err = meas - sp;
+		sumsq += err * err;
+		if (err > overshoot) overshoot = err;
+		if (meas > measpeak) measpeak = meas;
+		if (sp >= liquidus) talsp++;
+		if (meas >= liquidus) talmeas++;
+		steps++;
+
+		Oven_Step(&oven, heat / 255.0f, fan / 255.0f, STEP_SECS);
+	}
+
+	res->rms = steps ? sqrtf(sumsq / steps) : 0.0f;
+	res->overshoot = overshoot;
+	res->peak = fabsf(measpeak - profilepeak);
+	res->tal = fabsf((float)talmeas - (float)talsp) * STEP_SECS;
+	res->score = res->rms + res->overshoot + res->peak + res->tal * TAL_WEIGHT;
+}
+
+static void FirmwareInit(void) {
+	Sim_SetDuration(1e9); // Keep the simulated peripherals running for as long as it takes
+	VIC_Init();
+	Sched_Init();
+	I2C_Init();
+	NV_Init();
+	Reflow_Init();
+}
+
+static int CompareScore(const void* a, const void* b) {
+	float sa = ((const Result_t*)a)->score, sb = ((const Result_t*)b)->score;
+	return (sa > sb) - (sa < sb);
+}
+
+static void Usage(const char* name) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -p start:stop:step  Kp range (default 10:40:5)\n"
+		"  -i start:stop:step  Ki range (default 0:0.04:0.008)\n"
+		"  -d start:stop:step  Kd range (default 0:100:20)\n"
+		"  -f start:stop:step  Feedforward gain range (default 100)\n"
+		"  -m                  Use the model predictive controller, gains are ignored\n"
+		"  -j jobs             Worker processes (default: number of cores)\n"
+		"  -n count            Number of best results to list (default 10)\n"
+		"  -c file             Write every single run to a CSV file\n"
+		"Oven model parameters are taken from SIM_OVEN, see sim/oven.c\n", name);
+}
+
+int main(int argc, char** argv) {
+	Range_t kp = { 10.0f, 40.0f, 5.0f };
+	Range_t ki = { 0.0f, 0.04f, 0.008f };
+	Range_t kd = { 0.0f, 100.0f, 20.0f };
+	Range_t ff = { 100.0f, 100.0f, 0.0f };
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int listcount = 10;
+	int usempc = 0;
+	const char* csvname = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:i:d:f:mj:n:c:h")) != -1) {
+		switch (opt) {
+			case 'p': if (ParseRange(optarg, &kp)) return 1; break;
+			case 'i': if (ParseRange(optarg, &ki)) return 1; break;
+			case 'd': if (ParseRange(optarg, &kd)) return 1; break;
+			case 'f': if (ParseRange(optarg, &ff)) return 1; break;
+			case 'm': usempc = 1; break;
+			case 'j': jobs = atol(optarg); break;
+			case 'n': listcount = atoi(optarg); break;
+			case 'c': csvname = optarg; break;
+			default: Usage(argv[0]); return 1;
+		}
+	}
+	if (jobs < 1) jobs = 1;
+
+	Oven_DefaultParams(&ovenparams);
+	if (Oven_ParseParams(&ovenparams, getenv("SIM_OVEN"))) {
+		return 1;
+	}
+
+	// Profiles are the same for everyone, find the usable ones up front
+	fflush(stdout);
+	int savedstdout = dup(STDOUT_FILENO);
+	if (!freopen("/dev/null", "w", stdout)) {
+		return 1;
+	}
+	FirmwareInit();
+	NV_SetConfig(REFLOW_MPC, usempc);
+	int32_t numprofiles = Reflow_GetNumProfiles();
+	int32_t profiles[numprofiles];
+	const char* names[numprofiles];
+	int32_t numusable = 0;
+	for (int32_t i = 0; i < numprofiles; i++) {
+		float peak;
+		if (ProfilePeak(i, &peak)) {
+			names[numusable] = Reflow_GetProfileName();
+			profiles[numusable++] = i;
+		}
+	}
+	fflush(stdout);
+	dup2(savedstdout, STDOUT_FILENO);
+	close(savedstdout);
+
+	uint32_t nkp = RangeCount(&kp), nki = RangeCount(&ki), nkd = RangeCount(&kd), nff = RangeCount(&ff);
+	uint32_t numcombos = nkp * nki * nkd * nff;
+	uint32_t numruns = numcombos * numusable;
+	if (numruns == 0) {
+		fprintf(stderr, "Nothing to do\n");
+		return 1;
+	}
+	if (jobs > numruns) jobs = numruns;
+
+	Result_t* results = calloc(numruns, sizeof(Result_t));
+	int fds[jobs];
+	pid_t pids[jobs];
+
+	// Every worker takes every jobs'th run and streams its results back through a pipe
+	for (long w = 0; w < jobs; w++) {
+		int pipefd[2];
+		if (pipe(pipefd)) {
+			perror("pipe");
+			return 1;
+		}
+		pids[w] = fork();
+		if (pids[w] == 0) {
+			close(pipefd[0]);
+			if (!freopen("/dev/null", "w", stdout)) {
+				_exit(1);
+			}
+			for (uint32_t run = w; run < numruns; run += jobs) {
+				Result_t res;
+				uint32_t combo = run / numusable;
+				res.combo = combo;
+				res.profile = profiles[run % numusable];
+				res.kp = RangeValue(&kp, combo / (nki * nkd * nff));
+				res.ki = RangeValue(&ki, (combo / (nkd * nff)) % nki);
+				res.kd = RangeValue(&kd, (combo / nff) % nkd);
+				res.ff = RangeValue(&ff, combo % nff);
+				RunProfile(&res);
+				if (write(pipefd[1], &res, sizeof(res)) != sizeof(res)) {
+					_exit(1);
+				}
+			}
+			close(pipefd[1]);
+			_exit(0);
+		} else if (pids[w] < 0) {
+			perror("fork");
+			return 1;
+		}
+		close(pipefd[1]);
+		fds[w] = pipefd[0];
+	}
+
+	uint32_t received = 0;
+	for (long w = 0; w < jobs; w++) {
+		Result_t res;
+		while (read(fds[w], &res, sizeof(res)) == sizeof(res)) {
+			results[received++] = res;
+		}
+		close(fds[w]);
+		waitpid(pids[w], NULL, 0);
+	}
+	if (received != numruns) {
+		fprintf(stderr, "Only got %u of %u results\n", received, numruns);
+		return 1;
+	}
+
+	if (csvname) {
+		FILE* csv = fopen(csvname, "w");
+		if (!csv) {
+			perror(csvname);
+			return 1;
+		}
+		fprintf(csv, "kp,ki,kd,ff,profile,rms,overshoot,peak,tal,score\n");
+		for (uint32_t i = 0; i < numruns; i++) {
+			Result_t* r = &results[i];
+			fprintf(csv, "%g,%g,%g,%g,%d,%.2f,%.2f,%.2f,%.2f,%.2f\n", r->kp, r->ki, r->kd, r->ff,
+			        r->profile, r->rms, r->overshoot, r->peak, r->tal, r->score);
+		}
+		fclose(csv);
+	}
+
+	// Average every gain combination over all profiles
+	Result_t* combos = calloc(numcombos, sizeof(Result_t));
+	for (uint32_t i = 0; i < numruns; i++) {
+		Result_t* r = &results[i];
+		Result_t* c = &combos[r->combo];
+		c->combo = r->combo;
+		c->kp = r->kp;
+		c->ki = r->ki;
+		c->kd = r->kd;
+		c->ff = r->ff;
+		c->rms += r->rms / numusable;
+		c->overshoot += r->overshoot / numusable;
+		c->peak += r->peak / numusable;
+		c->tal += r->tal / numusable;
+		c->score += r->score / numusable;
+	}
+	qsort(combos, numcombos, sizeof(Result_t), CompareScore);
+
+	printf("%u gain combinations x %d profiles on %ld workers:\n", numcombos, numusable, jobs);
+	for (int32_t i = 0; i < numusable; i++) {
+		printf("  %d: %s\n", profiles[i], names[i]);
+	}
+	printf("\n%8s %8s %8s %5s %8s %8s %9s %8s %8s\n", "Kp", "Ki", "Kd", "FF", "Score", "RMS", "Overshoot", "Peak", "TAL(s)");
+	for (int i = 0; i < listcount && i < numcombos; i++) {
+		Result_t* c = &combos[i];
+		printf("%8.3f %8.4f %8.3f %5.0f %8.2f %8.2f %9.2f %8.2f %8.1f\n",
+		       c->kp, c->ki, c->kd, c->ff, c->score, c->rms, c->overshoot, c->peak, c->tal);
+	}
+	free(combos);
+	free(results);
+	return 0;
+}
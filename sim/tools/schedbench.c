@@ -0,0 +1,120 @@
+/*
+ * schedbench.c - Dispatch cost of the scheduler for different numbers of tasks
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "t962.h"
+#include "sched.h"
+#include "vic.h"
+#include "sim.h"
+
+/*
+ * Registers 12, 32 and 64 tasks, each re-arming itself with a pseudo random
+ * period of 1 - 50ms, and times one Sched_Do pass per BENCH_TICK_MS of
+ * fast-forwarded time. Every pass dispatches whatever has become due in that
+ * tick, so the cost per dispatched task shows how the deadline heap scales.
+ * Also times idle passes where nothing is due, those should cost the same
+ * regardless of the number of tasks.
+ *
+ * Built with SCHED_MAX_TASKS set to 64, see the Makefile. Times are host
+ * nanoseconds including the simulated register accesses, they only make sense
+ * relative to each other.
+ */
+
+#define BENCH_DEFAULT_TICKS (200000)
+#define BENCH_TICK_MS (1)
+
+static uint32_t lcg = 12345;
+static uint32_t dispatched = 0;
+
+static int32_t Bench_Random(void) {
+	lcg = lcg * 1103515245 + 12345;
+	return TICKS_MS(1) + (lcg >> 8) % (TICKS_MS(50) - TICKS_MS(1));
+}
+
+static int32_t Bench_Work(void) {
+	dispatched++;
+	return Bench_Random();
+}
+
+static uint64_t Bench_Ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void Bench_Run(uint8_t numtasks, uint32_t passes) {
+	for (uint8_t t = 0; t < numtasks; t++) {
+		Sched_SetWorkfunc(t, Bench_Work);
+		Sched_SetState(t, 1, Bench_Random());
+	}
+
+	// Settle into a steady state before timing anything
+	for (uint32_t i = 0; i < passes / 10; i++) {
+		Sched_Do(TICKS_MS(BENCH_TICK_MS));
+	}
+
+	uint64_t busyns = 0, idlens = 0;
+	uint32_t idlepasses = 0;
+	dispatched = 0;
+	for (uint32_t i = 0; i < passes; i++) {
+		uint64_t start = Bench_Ns();
+		int32_t wait = Sched_Do(TICKS_MS(BENCH_TICK_MS));
+		uint64_t mid = Bench_Ns();
+		busyns += mid - start;
+		if (wait > 0) { // Nothing left due, the same call again has nothing to do
+			Sched_Do(0);
+			idlens += Bench_Ns() - mid;
+			idlepasses++;
+		}
+	}
+
+	printf("%5u %10u %9.2f %9.0f %9.0f %9.0f\n", numtasks, passes, (double)dispatched / passes,
+	       (double)busyns / passes, dispatched ? (double)busyns / dispatched : 0.0,
+	       idlepasses ? (double)idlens / idlepasses : 0.0);
+
+	for (uint8_t t = 0; t < numtasks; t++) {
+		Sched_SetState(t, 0, 0);
+	}
+}
+
+int main(int argc, char** argv) {
+	static const uint8_t counts[] = { 12, 32, 64 };
+	uint32_t passes = (argc > 1) ? (uint32_t)atol(argv[1]) : BENCH_DEFAULT_TICKS;
+	if (passes == 0) {
+		fprintf(stderr, "Usage: %s [ticks]\n", argv[0]);
+		return 1;
+	}
+
+	Sim_SetDuration(1e9); // Register accesses move virtual time, don't let the run end
+	VIC_Init();
+	Sched_Init();
+
+	printf("%5s %10s %9s %9s %9s %9s\n", "Tasks", "Ticks", "Disp/tick", "ns/tick", "ns/disp", "ns/idle");
+	for (uint32_t i = 0; i < sizeof(counts); i++) {
+		if (counts[i] > SCHED_MAX_TASKS) {
+			fprintf(stderr, "SCHED_MAX_TASKS is only %d\n", SCHED_MAX_TASKS);
+			return 1;
+		}
+		Bench_Run(counts[i], passes);
+	}
+	return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * vic_sim.c - Simulated vectored interrupt controller for the host build
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include "t962.h"
+#include "sched.h"
+#include "vic.h"
+#include "sim.h"
+
+// Replaces src/vic.c. Handlers are plain function calls made from the
+// simulation whenever IRQs are enabled, they never nest just like on target.
+
+typedef void (*VICHandler_t)(void);
+
+static VICHandler_t handlers[VICINT_NUM_ITEMS];
+static uint32_t intenable = 0;
+static uint32_t intpending = 0;
+static uint32_t irqdisabled = 0; // Stand-in for the I bit in CPSR
+static uint8_t inirq = 0;
+
+void VIC_Init( void ) {
+	intenable = 0;
+	intpending = 0;
+}
+
+uint32_t VIC_IsIRQDisabled( void ) {
+	return irqdisabled || inirq;
+}
+
+uint32_t VIC_DisableIRQ( void ) {
+	uint32_t retval = VIC_IsIRQDisabled();
+	irqdisabled = 1;
+	return retval;
+}
+
+void VIC_RestoreIRQ( uint32_t mask ) {
+	Sim_Sync(); // Idle mode (PCON) is typically entered right before this
+	irqdisabled = mask;
+	VIC_Dispatch();
+}
+
+int32_t VIC_RegisterHandler( VICInt_t num, void* ptr ) {
+	if (num >= VICINT_NUM_ITEMS) {
+		return -1;
+	}
+	handlers[num] = (VICHandler_t)ptr;
+	return 0;
+}
+
+int32_t VIC_EnableHandler( VICInt_t num ) {
+	intenable |= (1 << num);
+	return 0;
+}
+
+int32_t VIC_DisableHandler( VICInt_t num ) {
+	intenable &= ~(1 << num);
+	return 0;
+}
+
+// Flags an interrupt request, it's serviced on the next VIC_Dispatch
+void VIC_Raise( VICInt_t num ) {
+	intpending |= (1 << num);
+}
+
+// An enabled request is waiting, masked IRQs or not. Keeps the core from idling.
+uint32_t VIC_IsPending( void ) {
+	return !!(intpending & intenable);
+}
+
+void VIC_Dispatch( void ) {
+	if (irqdisabled || inirq) {
+		return;
+	}
+	inirq = 1;
+	while (intpending & intenable) {
+		uint32_t num = __builtin_ctz(intpending & intenable);
+		intpending &= ~(1 << num);
+		if (handlers[num]) {
+			handlers[num]();
+		}
+	}
+	inirq = 0;
+}
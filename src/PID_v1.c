@@ -19,10 +19,13 @@ void PID_init(PidType* pid, FloatType Kp, FloatType Ki, FloatType Kd,
   pid->myOutput = 0;
   pid->mySetpoint = 0;
   pid->ITerm = 0;
+#ifdef PID_FIXEDPOINT
+  pid->ITermFrac = 0;
+#endif
   pid->lastInput = 0;
   pid->inAuto = false;
 
-  PID_SetOutputLimits(pid, 0, 0xffff);
+  PID_SetOutputLimits(pid, 0, PID_VALUE_MAX);
 
   //default Controller Sample Time is 0.1 seconds
   pid->SampleTime = 100;
@@ -48,17 +51,40 @@ bool PID_Compute(PidType* pid) {
 //  unsigned long timeChange = (now - pid->lastTime);
 //  if (timeChange >= pid->SampleTime) {
     /*Compute all the working error variables*/
-    FloatType input = pid->myInput;
-    FloatType error = pid->mySetpoint - input;
-    pid->ITerm += (pid->ki * error);
+    PidValue input = pid->myInput;
+    PidValue error = pid->mySetpoint - input;
+    PidValue dInput = (input - pid->lastInput);
+#ifdef PID_FIXEDPOINT
+    // ki has PID_KI_FRACBITS, what doesn't fit the ITerm resolution is kept for the next step
+    int64_t iProduct = (int64_t)pid->ki * error + pid->ITermFrac;
+    PidValue iStep = (PidValue)(iProduct >> PID_KI_FRACBITS);
+    // Products are Q32.32, kp * error alone can exceed the Q16.16 range before clamping
+    int64_t pdOutput = ((int64_t)pid->kp * error - (int64_t)pid->kd * dInput) >> PID_FRACBITS;
+#else
+    FloatType iStep = (pid->ki * error);
+    FloatType pdOutput = pid->kp * error - pid->kd * dInput;
+#endif
+
+    /*Conditional integration: don't let the integrator push further
+      into a limit the output is already saturated against*/
+    if (!((pdOutput + pid->ITerm >= pid->outMax && iStep > 0) ||
+          (pdOutput + pid->ITerm <= pid->outMin && iStep < 0))) {
+      pid->ITerm += iStep;
+#ifdef PID_FIXEDPOINT
+      pid->ITermFrac = (uint32_t)(iProduct & ((1 << PID_KI_FRACBITS) - 1));
+#endif
+    }
     if (pid->ITerm > pid->outMax)
       pid->ITerm = pid->outMax;
     else if (pid->ITerm < pid->outMin)
       pid->ITerm = pid->outMin;
-    FloatType dInput = (input - pid->lastInput);
 
     /*Compute PID Output*/
-    FloatType output = pid->kp * error + pid->ITerm - pid->kd * dInput;
+#ifdef PID_FIXEDPOINT
+    int64_t output = pdOutput + pid->ITerm;
+#else
+    FloatType output = pdOutput + pid->ITerm;
+#endif
 
     if (output > pid->outMax)
       output = pid->outMax;
@@ -92,9 +118,13 @@ void PID_SetTunings(PidType* pid, FloatType Kp, FloatType Ki, FloatType Kd) {
   pid->dispKd = Kd;
 
   FloatType SampleTimeInSec = ((FloatType) pid->SampleTime) / 1000;
-  pid->kp = Kp;
-  pid->ki = Ki * SampleTimeInSec;
-  pid->kd = Kd / SampleTimeInSec;
+  pid->kp = PID_FROM_FLOAT(Kp);
+#ifdef PID_FIXEDPOINT
+  pid->ki = (PidValue)(Ki * SampleTimeInSec * (FloatType)(1 << PID_KI_FRACBITS) + 0.5f);
+#else
+  pid->ki = PID_FROM_FLOAT(Ki * SampleTimeInSec);
+#endif
+  pid->kd = PID_FROM_FLOAT(Kd / SampleTimeInSec);
 
   if (pid->controllerDirection == PID_Direction_Reverse) {
     pid->kp = (0 - pid->kp);
@@ -108,9 +138,14 @@ void PID_SetTunings(PidType* pid, FloatType Kp, FloatType Ki, FloatType Kd) {
  ******************************************************************************/
 void PID_SetSampleTime(PidType* pid, int NewSampleTime) {
   if (NewSampleTime > 0) {
+#ifdef PID_FIXEDPOINT
+    pid->ki = (PidValue)((int64_t)pid->ki * NewSampleTime / (int64_t)pid->SampleTime);
+    pid->kd = (PidValue)((int64_t)pid->kd * (int64_t)pid->SampleTime / NewSampleTime);
+#else
     FloatType ratio = (FloatType) NewSampleTime / (FloatType) pid->SampleTime;
     pid->ki *= ratio;
     pid->kd /= ratio;
+#endif
     pid->SampleTime = (unsigned long) NewSampleTime;
   }
 }
@@ -127,8 +162,8 @@ void PID_SetOutputLimits(PidType* pid, FloatType Min, FloatType Max) {
   if (Min >= Max) {
     return;
   }
-  pid->outMin = Min;
-  pid->outMax = Max;
+  pid->outMin = PID_FROM_FLOAT(Min);
+  pid->outMax = PID_FROM_FLOAT(Max);
 
   if (pid->inAuto) {
     if (pid->myOutput > pid->outMax) {
@@ -166,6 +201,9 @@ void PID_SetMode(PidType* pid, PidModeType Mode)
  ******************************************************************************/
 void PID_Initialize(PidType* pid) {
   pid->ITerm = pid->myOutput;
+#ifdef PID_FIXEDPOINT
+  pid->ITermFrac = 0;
+#endif
   pid->lastInput = pid->myInput;
   if (pid->ITerm > pid->outMax) {
     pid->ITerm = pid->outMax;
@@ -4,6 +4,35 @@
 typedef float FloatType;
 //typedef double floatType;
 #include <stdbool.h>
+#include <stdint.h>
+
+// Run the controller in Q16.16 fixed point, there is no FPU to do the float math.
+// Tunings and limits are still given as floats, input/output/setpoint are PidValue.
+// Host tools define PID_FLOATINGPOINT to build the float version for reference.
+#ifndef PID_FLOATINGPOINT
+#define PID_FIXEDPOINT
+#endif
+
+#ifdef PID_FIXEDPOINT
+typedef int32_t PidValue;
+#define PID_FRACBITS (16)
+#define PID_FROM_INT(x) ((PidValue)(x) << PID_FRACBITS)
+#define PID_FROM_FLOAT(x) ((PidValue)((x) * (FloatType)(1 << PID_FRACBITS) + ((x) < 0 ? -0.5f : 0.5f)))
+#define PID_FROM_FIXED(x, fracbits) ((PidValue)(x) << (PID_FRACBITS - (fracbits)))
+#define PID_TO_INT(x) ((int32_t)(x) >> PID_FRACBITS)
+#define PID_TO_FLOAT(x) ((FloatType)(x) / (FloatType)(1 << PID_FRACBITS))
+#define PID_VALUE_MAX (32767)
+// Ki * SampleTime is tiny, 0.00005 for Ki 0.001 at 50ms, it gets 8 more fraction bits
+#define PID_KI_FRACBITS (24)
+#else
+typedef FloatType PidValue;
+#define PID_FROM_INT(x) ((PidValue)(x))
+#define PID_FROM_FLOAT(x) ((PidValue)(x))
+#define PID_FROM_FIXED(x, fracbits) ((PidValue)(x) / (FloatType)(1 << (fracbits)))
+#define PID_TO_INT(x) ((int32_t)(x))
+#define PID_TO_FLOAT(x) ((FloatType)(x))
+#define PID_VALUE_MAX (0xffff)
+#endif
 
 //Constants used in some of the functions below
 typedef enum
@@ -23,22 +52,25 @@ typedef struct {
   FloatType dispKi; //   format for display purposes
   FloatType dispKd; //
 
-  FloatType kp; // * (P)roportional Tuning Parameter
-  FloatType ki; // * (I)ntegral Tuning Parameter
-  FloatType kd; // * (D)erivative Tuning Parameter
+  PidValue kp; // * (P)roportional Tuning Parameter
+  PidValue ki; // * (I)ntegral Tuning Parameter
+  PidValue kd; // * (D)erivative Tuning Parameter
 
   PidDirectionType controllerDirection;
 
-  FloatType myInput; // * Pointers to the Input, Output, and Setpoint variables
-  FloatType myOutput; //   This creates a hard link between the variables and the
-  FloatType mySetpoint; //   PID, freeing the user from having to constantly tell us
+  PidValue myInput; // * Pointers to the Input, Output, and Setpoint variables
+  PidValue myOutput; //   This creates a hard link between the variables and the
+  PidValue mySetpoint; //   PID, freeing the user from having to constantly tell us
                      //   what these values are.  with pointers we'll just know.
 
 //  unsigned long lastTime;
-  FloatType ITerm, lastInput;
+  PidValue ITerm, lastInput;
+#ifdef PID_FIXEDPOINT
+  uint32_t ITermFrac; // Integrator step below the ITerm resolution, carried to the next one
+#endif
 
   unsigned long SampleTime;
-  FloatType outMin, outMax;
+  PidValue outMin, outMax;
   bool inAuto;
 } PidType;
 
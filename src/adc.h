@@ -1,6 +1,9 @@
 #ifndef ADC_H_
 #define ADC_H_
 
+// Readings are a moving average over 25.6ms, centered this far back
+#define ADC_AVERAGE_AGE_MS (13)
+
 void ADC_Init(void);
 int32_t ADC_Read(uint32_t chnum);
 
@@ -22,17 +22,25 @@
 #include <stdio.h>
 #include "t962.h"
 #include "i2c.h"
+#include "sched.h"
+#include "vic.h"
 
 // Limit to i2c speed 200kHz because of the relatively weak 4k7 pullups
 #define I2CSPEED (200000)
 
-void I2C_Init(void) {
-	uint8_t dummybyte;
-	I20SCLL = I20SCLH = PCLKFREQ / I2CSPEED / 2;
-	I20CONCLR = 0xff;
-	I20CONSET = (1 << 6); // I2EN
-	I2C_Xfer(0xff, &dummybyte, 0, 1); // Dummy initial xfer
-}
+/*
+ * Transfers are queued and carried out by the I2C0 interrupt one bus event at
+ * a time, so the CPU is free while the bytes are clocked. Completion callbacks
+ * are made from I2C_Work in task context. A transfer that hasn't completed
+ * within I2C_TIMEOUT_MS (slave stretching the clock forever, bus stuck low)
+ * is failed, the interface is reset and the queue moves on.
+ *
+ * I2C_Xfer keeps the old blocking interface on top of the queue for code that
+ * can't easily be split up, like init and the EEPROM backed NV storage.
+ */
+
+#define I2C_TIMEOUT_MS (20)
+#define I2C_EVENT_DONE (1 << 0)
 
 #define I2CSTART (0x08)
 #define I2CRSTART (0x10)
@@ -46,70 +54,230 @@ void I2C_Init(void) {
 #define I2CRDACK (0x50)
 #define I2CRDNOACK (0x58)
 
-int32_t I2C_Xfer(uint8_t slaveaddr, uint8_t* theBuffer, uint32_t theLength, uint8_t trailingStop) {
-	int32_t retval = 0;
-	int done = 0;
-	uint8_t stat;
-
-	I20CONSET = (1 << 5); // STA
-	//printf("\n[STA]");
-
-	while (!done) {
-		while (!(I20CONSET & (1 << 3))); // SI
-		stat = I20STAT;
-		//printf("[0x%02x]", stat);
-		switch(stat) {
-			case I2CSTART:
-			case I2CRSTART:
-				I20DAT = slaveaddr;
-				I20CONCLR = (1 << 5); // Clear STA
-				//printf("[WADDR]");
-				break;
-			case I2CWANOACK:
-			case I2CWDNOACK:
-			case I2CARBLOST:
-			case I2CRANOACK:
-				//printf("[I2C error!]");
-				trailingStop = 1; // Force STOP condition at the end no matter what
-				retval = -1;
-				done = 1;
-				break;
+// I2CONSET/I2CONCLR bits
+#define I2CAA (1 << 2)
+#define I2CSI (1 << 3)
+#define I2CSTO (1 << 4)
+#define I2CSTA (1 << 5)
+#define I2CEN (1 << 6)
 
-			case I2CWAACK:
-			case I2CWDACK:
-				if (theLength) {
-					I20DAT = *theBuffer++;
-					theLength--;
-					//printf("[WDATA]");
-				} else {
-					done=1;
-				}
-				break;
+static I2CXfer_t* volatile i2chead = NULL; // On the bus, the rest of the queue follows
+static I2CXfer_t* i2ctail = NULL;
+static I2CXfer_t* volatile donehead = NULL; // Waiting for their callbacks
+static I2CXfer_t* donetail = NULL;
+static uint8_t* i2cptr;
+static uint32_t i2cleft;
+static volatile uint8_t i2cheld = 0; // Bus kept after an I2C_XFER_NOSTOP transfer, SI still set
+static volatile uint32_t i2cseq = 0; // Bumped for every finished transfer
+static uint32_t seqseen;
+static uint32_t seqtick;
+
+// Takes the transfer on the bus off the queue
+static void I2C_Finish(int32_t result) {
+	I2CXfer_t* x = i2chead;
+	i2chead = x->next;
+	if (i2chead == NULL) {
+		i2ctail = NULL;
+	}
+	i2cseq++;
+	x->next = NULL;
+	if (x->done) {
+		if (donehead) {
+			donetail->next = x;
+		} else {
+			donehead = x;
+		}
+		donetail = x;
+		x->result = result;
+		Sched_PostFromISR(I2C_WORK, I2C_EVENT_DONE, 0);
+	} else {
+		x->result = result; // Last access, a blocking caller may reuse it right away
+	}
+}
+
+// Ends the transfer on the bus and gets the next one going
+static void I2C_Done(int32_t result) {
+	uint8_t hold = (result == 0) && (i2chead->flags & I2C_XFER_NOSTOP);
+	I2C_Finish(result);
+	if (!hold) {
+		I20CONSET = i2chead ? (I2CSTO | I2CSTA) : I2CSTO;
+		I20CONCLR = I2CSI;
+	} else if (i2chead) {
+		I20CONSET = I2CSTA; // Repeated start
+		I20CONCLR = I2CSI;
+	} else {
+		// SI stays set until I2C_Submit has the next transfer, keep it from interrupting
+		i2cheld = 1;
+		VIC_DisableHandler(VIC_I2C0);
+	}
+}
+
+static void I2C_Step(void) {
+	I2CXfer_t* x = i2chead;
+	uint8_t stat = I20STAT;
+
+	if (x == NULL) { // Aborted under our feet
+		I20CONSET = I2CSTO;
+		I20CONCLR = I2CSI;
+		return;
+	}
+	switch (stat) {
+		case I2CSTART:
+		case I2CRSTART:
+			i2cptr = x->buf;
+			i2cleft = x->len;
+			I20DAT = x->slaveaddr;
+			I20CONCLR = I2CSTA | I2CSI;
+			break;
+
+		case I2CWAACK:
+		case I2CWDACK:
+			if (i2cleft) {
+				I20DAT = *i2cptr++;
+				i2cleft--;
+				I20CONCLR = I2CSI;
+			} else {
+				I2C_Done(0);
+			}
+			break;
 
-			case I2CRAACK:
-				//printf("[RADDR]");
-				I20CONSET = (1 << 2); // Set AA
+		case I2CRAACK:
+			if (i2cleft == 0) {
+				I2C_Done(0);
 				break;
+			}
+			if (i2cleft > 1) {
+				I20CONSET = I2CAA;
+			} else {
+				I20CONCLR = I2CAA; // Only byte, NACK it
+			}
+			I20CONCLR = I2CSI;
+			break;
 
-			case I2CRDACK:
-			case I2CRDNOACK:
-				*theBuffer++ = I20DAT;
-				theLength--;
-				if (theLength == 1) {
-					I20CONCLR = (1 << 2); // Clear AA for last byte
-				} else if (theLength == 0) {
-					done = 1;
-				}
-				//if(!done) printf("[RDATA]");
+		case I2CRDACK:
+		case I2CRDNOACK:
+			*i2cptr++ = I20DAT;
+			i2cleft--;
+			if (stat == I2CRDNOACK || i2cleft == 0) {
+				I2C_Done(0);
 				break;
+			}
+			if (i2cleft == 1) {
+				I20CONCLR = I2CAA; // NACK the last byte
+			}
+			I20CONCLR = I2CSI;
+			break;
+
+		case I2CWANOACK:
+		case I2CWDNOACK:
+		case I2CARBLOST:
+		case I2CRANOACK:
+		default: // Bus error
+			I2C_Done(I2C_NOACK);
+			break;
+	}
+}
+
+static void __attribute__ ((interrupt ("IRQ"))) I2C_IRQHandler(void) {
+	I2C_Step();
+	VICVectAddr = 0; // ACK irq
+}
+
+// Fails the transfer on the bus and resets the interface, then starts the next one
+static void I2C_Abort(void) {
+	uint32_t save = VIC_DisableIRQ();
+	if (i2chead) {
+		I20CONCLR = I2CEN | I2CSTA | I2CSI | I2CAA;
+		I20CONSET = I2CEN;
+		I2C_Finish(I2C_TIMEOUT);
+		if (i2chead) {
+			I20CONSET = I2CSTA;
+		}
+	}
+	VIC_RestoreIRQ(save);
+}
+
+// Aborts the transfer on the bus when nothing has completed for I2C_TIMEOUT_MS
+static void I2C_CheckTimeout(void) {
+	uint32_t now = Sched_GetTick();
+	if (i2cseq != seqseen) {
+		seqseen = i2cseq;
+		seqtick = now;
+	} else if (i2chead && (now - seqtick) >= TICKS_MS(I2C_TIMEOUT_MS)) {
+		printf("\nI2C transfer to 0x%02x timed out", i2chead->slaveaddr >> 1);
+		I2C_Abort();
+	}
+}
+
+static int32_t I2C_Work(void) {
+	if (Sched_GetEvents(I2C_WORK) & I2C_EVENT_DONE) {
+		while (1) {
+			uint32_t save = VIC_DisableIRQ();
+			I2CXfer_t* x = donehead;
+			if (x) {
+				donehead = x->next;
+				x->next = NULL;
+			}
+			VIC_RestoreIRQ(save);
+			if (x == NULL) break;
+			x->done(x); // May well submit a new transfer
 		}
-		I20CONCLR = (1 << 3); // Clear SI
 	}
+	I2C_CheckTimeout();
+	return i2chead ? TICKS_MS(I2C_TIMEOUT_MS) : -1;
+}
 
-	if (trailingStop) {
-		I20CONSET = (1 << 4); // STO
-		//printf("[STO]");
-		while (I20CONSET & (1 << 4)); // Wait for STO to clear
+// Queues a transfer, xfer has to stay around until its done callback has been called.
+// Not to be used from interrupt context.
+void I2C_Submit(I2CXfer_t* xfer) {
+	xfer->next = NULL;
+	xfer->result = I2C_PENDING;
+	uint32_t save = VIC_DisableIRQ();
+	if (i2chead) {
+		i2ctail->next = xfer;
+		i2ctail = xfer;
+	} else {
+		i2chead = i2ctail = xfer;
+		seqseen = i2cseq;
+		seqtick = Sched_GetTick();
+		I20CONSET = I2CSTA;
+		if (i2cheld) {
+			i2cheld = 0;
+			I20CONCLR = I2CSI; // Repeated start
+			VIC_EnableHandler(VIC_I2C0);
+		}
+		Sched_SetState(I2C_WORK, 1, TICKS_MS(I2C_TIMEOUT_MS));
 	}
-	return retval;
+	VIC_RestoreIRQ(save);
+}
+
+// Queues a transfer and waits for it to finish. Without trailingStop the bus is
+// held and the next transfer continues with a repeated start.
+int32_t I2C_Xfer(uint8_t slaveaddr, uint8_t* theBuffer, uint32_t theLength, uint8_t trailingStop) {
+	I2CXfer_t xfer = {
+		.slaveaddr = slaveaddr,
+		.flags = trailingStop ? 0 : I2C_XFER_NOSTOP,
+		.buf = theBuffer,
+		.len = theLength,
+		.done = NULL,
+	};
+	I2C_Submit(&xfer);
+	// Anything queued earlier goes first. I2C_Work can't run from here so
+	// check for timeouts here instead, the core can't idle as there might not
+	// be any other interrupt to wake it up if the bus hangs.
+	while (xfer.result == I2C_PENDING) {
+		I2C_CheckTimeout();
+	}
+	return xfer.result;
+}
+
+void I2C_Init(void) {
+	uint8_t dummybyte;
+	Sched_SetWorkfunc(I2C_WORK, I2C_Work);
+	I20SCLL = I20SCLH = PCLKFREQ / I2CSPEED / 2;
+	I20CONCLR = 0xff;
+	I20CONSET = I2CEN;
+	VIC_RegisterHandler(VIC_I2C0, I2C_IRQHandler);
+	VIC_EnableHandler(VIC_I2C0);
+	I2C_Xfer(0xff, &dummybyte, 0, 1); // Dummy initial xfer
 }
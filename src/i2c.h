@@ -1,7 +1,31 @@
 #ifndef I2C_H_
 #define I2C_H_
 
+#include <stdint.h>
+
+#define I2C_XFER_NOSTOP (1 << 0) // Keep the bus, the next transfer follows with a repeated start
+
+#define I2C_PENDING (1) // Result while queued or on the bus
+#define I2C_NOACK (-1)
+#define I2C_TIMEOUT (-2)
+
+struct I2CXfer;
+
+// Called from I2C_Work when the transfer is done, the outcome is in xfer->result
+typedef void (*I2CDone_t)(struct I2CXfer* xfer);
+
+typedef struct I2CXfer {
+	uint8_t slaveaddr; // Bit 0 set for reads
+	uint8_t flags;
+	uint8_t* buf;
+	uint32_t len;
+	I2CDone_t done;
+	volatile int32_t result;
+	struct I2CXfer* next; // Owned by the queue until done
+} I2CXfer_t;
+
 void I2C_Init(void);
+void I2C_Submit(I2CXfer_t* xfer);
 int32_t I2C_Xfer(uint8_t slaveaddr, uint8_t* theBuffer, uint32_t theLength, uint8_t trailingStop);
 
 #endif /* I2C_H_ */
@@ -89,7 +89,7 @@ void IO_PrintResetReason(void) {
 
 // Support for boot ROM functions (get part number etc)
 typedef void (*IAP)(unsigned int [], unsigned int[]);
-static IAP iap_entry = (void*)0x7ffffff1;
+static IAP iap_entry = (void*)IAP_ENTRY;
 
 static partmapStruct partmap[] = {
 	{"LPC2131(/01)", 0x0002ff01}, // Probably pointless but present for completeness (32kB flash is too small for factory image)
@@ -3,7 +3,13 @@
 
 #define IAP_READ_PART (54)
 #define IAP_REINVOKE_ISP (57)
+// Boot ROM entry and part revision location, the host simulation supplies its own
+#ifndef IAP_ENTRY
+#define IAP_ENTRY (0x7ffffff1)
+#endif
+#ifndef PART_REV_ADDR
 #define PART_REV_ADDR (0x0007D070)
+#endif
 
 typedef struct {
     const char* name;
@@ -31,7 +31,8 @@
 #define F4KEY_PORTBIT (1 << 4)
 #define S_KEY_PORTBIT (1 << 20)
 
-#define KEYREPEATDELAY (6)
+#define KEYREPEATDELAY (600) // ms held before a key starts repeating
+#define KEYREPEATACCEL (100) // ms held per step of repeat acceleration
 
 static uint32_t latchedkeypadstate = 0;
 
@@ -41,7 +42,8 @@ static uint32_t Keypad_GetRaw(void) {
 
 static int32_t Keypad_Work(void) {
 	static uint32_t laststate = 0;
-	static uint16_t laststateunchangedctr = 0;
+	static uint64_t laststatechange = 0;
+	uint64_t now = Sched_GetMs();
 	uint32_t keypadstate = 0;
 	uint32_t inverted = Keypad_GetRaw();
 	uint32_t changed = inverted ^ laststate;
@@ -51,13 +53,15 @@ static int32_t Keypad_Work(void) {
 
 	if (laststate != inverted) {
 		laststate = inverted;
-		laststateunchangedctr = 0;
+		laststatechange = now;
 	} else {
-		laststateunchangedctr++;
-		if (laststateunchangedctr > KEYREPEATDELAY) {
+		uint32_t held = (uint32_t)(now - laststatechange);
+		if (held > KEYREPEATDELAY) {
 			changed = laststate; // Feed key repeat
-			// For accelerating key repeats
-			keypadstate |= ((laststateunchangedctr - KEYREPEATDELAY) << 16);
+			// For accelerating key repeats, capped to fit the upper half
+			uint32_t accel = (held - KEYREPEATDELAY) / KEYREPEATACCEL;
+			if (accel > 0xffff) accel = 0xffff;
+			keypadstate |= (accel << 16);
 		}
 	}
 
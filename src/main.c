@@ -33,6 +33,7 @@
 #include "keypad.h"
 #include "reflow.h"
 #include "reflow_profiles.h"
+#include "profilexfer.h"
 #include "sensor.h"
 #include "buzzer.h"
 #include "nvstorage.h"
@@ -63,19 +64,30 @@ static char* format_about = \
 static char* help_text = \
 "\nT-962-controller serial interface.\n\n" \
 " about                   Show about + debug information\n" \
+" autotune                Find PID gains with a relay feedback experiment\n" \
 " bake <setpoint>         Enter Bake mode with setpoint\n" \
 " bake <setpoint> <time>  Enter Bake mode with setpoint for <time> seconds\n" \
 " help                    Display help text\n" \
 " list profiles           List available reflow profiles\n" \
 " list settings           List machine settings\n" \
+" onewire stats           Show 1-wire readout error and latency counters\n" \
+" profile get <id>        Read reflow profile id as a binary frame\n" \
+" profile put <id>        Write custom reflow profile id from a binary frame\n" \
 " quiet                   No logging in standby mode\n" \
 " reflow                  Start reflow with selected profile\n" \
+" sched stats             Show per-task run time and latency statistics\n" \
 " setting <id> <value>    Set setting id to value\n" \
 " select profile <id>     Select reflow profile by id\n" \
 " stop                    Exit reflow or bake mode\n" \
 " values                  Dump currently measured values\n" \
 "\n";
 
+// Idle the core between scheduled tasks instead of spinning in the main loop
+#define ENABLE_SLEEP
+
+// Rows of settings fitting between the setup title and the button bar
+#define SETUP_VISIBLE_ROWS (7)
+
 static int32_t Main_Work(void);
 
 int main(void) {
@@ -128,19 +140,25 @@ int main(void) {
 	RTC_Init();
 	OneWire_Init();
 	SPI_TC_Init();
+	Sensor_Init();
 	Reflow_Init();
 	SystemFan_Init();
 
 	Sched_SetWorkfunc(MAIN_WORK, Main_Work);
+	Sched_SetPriority(MAIN_WORK, SCHED_PRIO_BACKGROUND); // UI redraws must not delay the control loop
 	Sched_SetState(MAIN_WORK, 1, TICKS_SECS(2)); // Enable in 2 seconds
 
 	Buzzer_Beep(BUZZ_1KHZ, 255, TICKS_MS(100));
 
+#ifdef ENABLE_SLEEP
+	uint32_t fastforward = 0;
+#endif
 	while (1) {
 #ifdef ENABLE_SLEEP
 		int32_t sleeptime;
-		sleeptime = Sched_Do(0); // No fast-forward support
+		sleeptime = Sched_Do(fastforward);
 		//printf("\n%d ticks 'til next activity"),sleeptime);
+		fastforward = Sched_Sleep(sleeptime);
 #else
 		Sched_Do(0); // No fast-forward support
 #endif
@@ -155,7 +173,8 @@ typedef enum eMainMode {
 	MAIN_BAKE,
 	MAIN_SELECT_PROFILE,
 	MAIN_EDIT_PROFILE,
-	MAIN_REFLOW
+	MAIN_REFLOW,
+	MAIN_AUTOTUNE
 } MainMode_t;
 
 static int32_t Main_Work(void) {
@@ -183,8 +202,12 @@ static int32_t Main_Work(void) {
 	char* cmd_bake = "bake %d %d";
 	char* cmd_dump_profile = "dump profile %d";
 	char* cmd_setting = "setting %d %f";
+	char* cmd_profile_get = "profile get %d";
+	char* cmd_profile_put = "profile put %d";
 
-	if (uart_isrxready()) {
+	if (ProfileXfer_IsReceiving()) {
+		ProfileXfer_Work();
+	} else if (uart_isrxready()) {
 		int len = uart_readline(serial_cmd, 255);
 
 		if (len > 0) {
@@ -222,6 +245,14 @@ static int32_t Main_Work(void) {
 					Setup_printFormattedValue(i);
 					printf("\n");
 				}
+				Reflow_ListTunings();
+
+			} else if (strcmp(serial_cmd, "autotune") == 0) {
+				printf("\nStarting PID autotune at %ddegC\n", AUTOTUNE_SETPOINT);
+				mode = MAIN_AUTOTUNE;
+				Reflow_Init();
+				Reflow_SetMode(REFLOW_AUTOTUNE);
+				retval = 0;
 
 			} else if (strcmp(serial_cmd, "stop") == 0) {
 				printf("\nStopping bake/reflow");
@@ -233,6 +264,14 @@ static int32_t Main_Work(void) {
 				Reflow_ToggleStandbyLogging();
 				printf("\nToggled standby logging\n");
 
+			} else if (strcmp(serial_cmd, "sched stats") == 0) {
+				printf("\nScheduler statistics:\n");
+				Sched_ListStats();
+
+			} else if (strcmp(serial_cmd, "onewire stats") == 0) {
+				printf("\n1-wire statistics:\n");
+				OneWire_ListStats();
+
 			} else if (strcmp(serial_cmd, "values") == 0) {
 				printf("\nActual measured values:\n");
 				Sensor_ListAll();
@@ -271,13 +310,22 @@ static int32_t Main_Work(void) {
 				Reflow_SetMode(REFLOW_BAKE);
 
 			} else if (sscanf(serial_cmd, cmd_dump_profile, &param) > 0) {
-				printf("\nDumping profile %d: %s\n ", param, Reflow_GetProfileName());
 				Reflow_DumpProfile(param);
 
+			} else if (sscanf(serial_cmd, cmd_profile_get, &param) > 0) {
+				ProfileXfer_Get(param);
+
+			} else if (sscanf(serial_cmd, cmd_profile_put, &param) > 0) {
+				ProfileXfer_StartPut(param);
+
 			} else if (sscanf(serial_cmd, cmd_setting, &param, &paramF) > 0) {
-				Setup_setRealValue(param, paramF);
-				printf("\nAdjusted setting: ");
-				Setup_printFormattedValue(param);
+				if (param < 0 || param >= Setup_getNumItems()) {
+					printf("\nNo setting %d, \"list settings\" shows them\n", param);
+				} else {
+					Setup_setRealValue(param, paramF);
+					printf("\nAdjusted setting: ");
+					Setup_printFormattedValue(param);
+				}
 
 			} else {
 				printf("\nCannot understand command, ? for help\n");
@@ -288,7 +336,10 @@ static int32_t Main_Work(void) {
 	// main menu state machine
 	if (mode == MAIN_SETUP) {
 		static uint8_t selected = 0;
+		static uint8_t firstrow = 0;
 		int y = 0;
+		// The last row isn't a setting but starts the autotune
+		int numrows = Setup_getNumItems() + 1;
 
 		int keyrepeataccel = keyspressed >> 17; // Divide the value by 2
 		if (keyrepeataccel < 1) keyrepeataccel = 1;
@@ -298,22 +349,33 @@ static int32_t Main_Work(void) {
 			if (selected > 0) { // Prev row
 				selected--;
 			} else { // wrap
-				selected = Setup_getNumItems() - 1;
+				selected = numrows - 1;
 			}
 		}
 		if (keyspressed & KEY_F2) {
-			if (selected < (Setup_getNumItems() - 1)) { // Next row
+			if (selected < (numrows - 1)) { // Next row
 				selected++;
 			} else { // wrap
 				selected = 0;
 			}
 		}
 
-		if (keyspressed & KEY_F3) {
-			Setup_decreaseValue(selected, keyrepeataccel);
-		}
-		if (keyspressed & KEY_F4) {
-			Setup_increaseValue(selected, keyrepeataccel);
+		if (selected == Setup_getNumItems()) {
+			if (keyspressed & KEY_F4) {
+				printf("\nStarting PID autotune at %ddegC\n", AUTOTUNE_SETPOINT);
+				mode = MAIN_AUTOTUNE;
+				Reflow_Init();
+				Reflow_SetMode(REFLOW_AUTOTUNE);
+				keyspressed = 0;
+				retval = 0; // Force immediate refresh
+			}
+		} else {
+			if (keyspressed & KEY_F3) {
+				Setup_decreaseValue(selected, keyrepeataccel);
+			}
+			if (keyspressed & KEY_F4) {
+				Setup_increaseValue(selected, keyrepeataccel);
+			}
 		}
 
 		LCD_FB_Clear();
@@ -321,8 +383,16 @@ static int32_t Main_Work(void) {
 		LCD_disp_str((uint8_t*)buf, len, LCD_ALIGN_CENTER(len), y, FONT6X6);
 		y += 7;
 
-		for (int i = 0; i < Setup_getNumItems() ; i++) {
-			len = Setup_snprintFormattedValue(buf, sizeof(buf), i);
+		// Scroll to keep the selected row on screen
+		if (selected < firstrow) firstrow = selected;
+		if (selected >= firstrow + SETUP_VISIBLE_ROWS) firstrow = selected - SETUP_VISIBLE_ROWS + 1;
+
+		for (int i = firstrow; i < numrows && i < firstrow + SETUP_VISIBLE_ROWS; i++) {
+			if (i < Setup_getNumItems()) {
+				len = Setup_snprintFormattedValue(buf, sizeof(buf), i);
+			} else {
+				len = snprintf(buf, sizeof(buf), "PID autotune   + run");
+			}
 			LCD_disp_str((uint8_t*)buf, len, 0, y, FONT6X6 | (selected == i) ? INVERT : 0);
 			y += 7;
 		}
@@ -359,7 +429,7 @@ static int32_t Main_Work(void) {
 			retval = 0; // Force immediate refresh
 		}
 	} else if (mode == MAIN_REFLOW) {
-		uint32_t ticks = RTC_Read();
+		uint32_t ticks = Reflow_GetTimeElapsed();
 
 		len = snprintf(buf, sizeof(buf), "%03u", Reflow_GetSetpoint());
 		LCD_disp_str((uint8_t*)"SET", 3, 110, 7, FONT6X6);
@@ -384,6 +454,33 @@ static int32_t Main_Work(void) {
 			retval = 0; // Force immediate refresh
 		}
 
+	} else if (mode == MAIN_AUTOTUNE) {
+		LCD_FB_Clear();
+		len = snprintf(buf, sizeof(buf), "PID AUTOTUNE");
+		LCD_disp_str((uint8_t*)buf, len, 0, 0, FONT6X6);
+		LCD_BMPDisplay(stopbmp, 127 - 17, 0);
+
+		len = snprintf(buf, sizeof(buf), "SET %3u`", Reflow_GetSetpoint());
+		LCD_disp_str((uint8_t*)buf, len, 0, 10, FONT6X6);
+		len = snprintf(buf, sizeof(buf), "ACT %3.1f`", Sensor_GetTemp(TC_AVERAGE));
+		LCD_disp_str((uint8_t*)buf, len, 0, 18, FONT6X6);
+		len = snprintf(buf, sizeof(buf), "CYCLE %d", Reflow_GetAutotuneCycle());
+		LCD_disp_str((uint8_t*)buf, len, 0, 26, FONT6X6);
+		int elapsed = Reflow_GetTimeElapsed();
+		len = snprintf(buf, sizeof(buf), "TIME %d:%02d", elapsed / 60, elapsed % 60);
+		LCD_disp_str((uint8_t*)buf, len, 0, 34, FONT6X6);
+
+		// Done, or abort
+		if (Reflow_IsDone() || keyspressed & KEY_S) {
+			printf("\nAutotune %s\n", (Reflow_IsDone() ? "done" : "interrupted by keypress"));
+			if (Reflow_IsDone()) {
+				Buzzer_Beep(BUZZ_1KHZ, 255, TICKS_MS(100) * NV_GetConfig(REFLOW_BEEP_DONE_LEN));
+			}
+			mode = MAIN_HOME;
+			Reflow_SetMode(REFLOW_STANDBY);
+			retval = 0; // Force immediate refresh
+		}
+
 	} else if (mode == MAIN_SELECT_PROFILE) {
 		int curprofile = Reflow_GetProfileIdx();
 		LCD_FB_Clear();
@@ -566,7 +663,7 @@ static int32_t Main_Work(void) {
 			retval = 0; // Force immediate refresh
 		}
 
-	} else if (mode == MAIN_EDIT_PROFILE) { // Edit ee1 or 2
+	} else if (mode == MAIN_EDIT_PROFILE) { // Edit a custom profile
 		LCD_FB_Clear();
 		int keyrepeataccel = keyspressed >> 17; // Divide the value by 2
 		if (keyrepeataccel < 1) keyrepeataccel = 1;
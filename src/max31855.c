@@ -21,32 +21,162 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include "max31855.h"
 #include "sc18is602b.h"
 #include "sched.h"
 
-#define INVALID_VALUE (999.0f)
+#define INVALID_VALUE (999 * 16) // 1/16 degC like the readings
 
 #define MAX_SPI_DEVICES (4)
 static int16_t spidevreadout[MAX_SPI_DEVICES]; // Keeps last readout from each device
 static int16_t spiextrareadout[MAX_SPI_DEVICES]; // Keeps last readout from each device
-static int numspidevices = 0;
+static uint8_t spifaults[MAX_SPI_DEVICES]; // MAX31855_FAULT_* bits of the last readout
+static uint8_t spibridge = 0; // I2C to SPI bridge found
+static uint8_t spipresent = 0; // Bitmap of slave selects with a MAX31855 responding
 
-static int32_t SPI_TC_Work( void ) {
-	for (int i = 0; i < numspidevices; i++) {
+// A conversion starts when CS goes high and takes at most this long, pulling CS low aborts it
+#define MAX31855_CONV_MS (100)
+
+// Slave selects without a device are tried again this often, interfaces may be plugged in at any time
+#define SPI_REPROBE_MS (2000)
+
+static const char* faultnames[] = { "open", "shorted to GND", "shorted to VCC" };
+
+typedef enum {
+	SPI_IDLE = 0,
+	SPI_TRIGGER,
+	SPI_TRIGGERING, // Restarting the conversions
+	SPI_CONVERTING,
+	SPI_READING,
+} SPIAcquire_t;
+
+static SPIAcquire_t spiacquiring = SPI_IDLE;
+static Task_t spinotify;
+static SPIxfer_t spixfers[MAX_SPI_DEVICES];
+static uint8_t spipending = 0;
+static uint8_t spipollmask; // Slave selects read in the current acquisition
+static uint64_t spiprobems = 0; // Last time all slave selects were read
+static uint64_t spiconvms; // Start of the current conversion
+static uint64_t spisamplems[MAX_SPI_DEVICES]; // When the last readout was converted
+
+/*
+ * Takes care of a 32-bit frame read from slave select idx. D17 and D3 always
+ * read as zero, an all-ones frame (MISO pulled up) or an all-zero one (not
+ * converted yet, MISO pulled down) means there's no live device there.
+ * D16 flags a thermocouple fault, with D2-D0 telling which one.
+ */
+static void SPI_TC_Update( int idx, const uint8_t* frame ) {
+	int16_t tc = frame[0] << 8 | frame[1];
+	int16_t cj = frame[2] << 8 | frame[3];
+	uint8_t bit = 1 << idx;
+
+	if ((tc & 0x0002) || (cj & 0x0008) || (tc == 0 && cj == 0)) {
+		if (spipresent & bit) {
+			printf("\nSS%x: [SPI Thermocouple interface] removed", idx);
+			spipresent &= ~bit;
+		}
+		return;
+	}
+	if (!(spipresent & bit)) {
+		printf("\nSS%x: [SPI Thermocouple interface]", idx);
+		spipresent |= bit;
+		spifaults[idx] = 0;
+	}
+	spidevreadout[idx] = tc;
+	spiextrareadout[idx] = cj;
+	spisamplems[idx] = spiconvms;
+
+	uint8_t faults = (tc & 0x0001) ? (cj & MAX31855_FAULT_MASK) : 0;
+	if (faults != spifaults[idx]) {
+		if (faults) {
+			for (int i = 0; i < 3; i++) {
+				if (faults & (1 << i)) {
+					printf("\nSS%x: Thermocouple %s", idx, faultnames[i]);
+				}
+			}
+		} else {
+			printf("\nSS%x: Thermocouple fault cleared", idx);
+		}
+		spifaults[idx] = faults;
+	}
+}
+
+static void SPI_TC_ReadAll( void ) {
+	spiconvms = Sched_GetMs();
+	for (int i = 0; i < MAX_SPI_DEVICES; i++) {
 		SPIxfer_t xfer;
 		xfer.ssmask = 1 << i;
 		xfer.len = 4; // 32 bits from TC interface
 
 		// Doesn't matter what data contains when sending, MOSI not connected
 		if (SC18IS602B_SPI_Xfer(&xfer) == 0) {
-			int16_t tmp = xfer.data[0] << 8 | xfer.data[1];
-			spidevreadout[i] = tmp;
+			SPI_TC_Update(i, xfer.data);
+		}
+	}
+	spiprobems = spiconvms;
+}
+
+static void SPI_TC_XferDone( SPIxfer_t* xfer, int32_t result ) {
+	int i = xfer - spixfers;
+	if (result == 0 && spiacquiring == SPI_READING) {
+		SPI_TC_Update(i, xfer->data);
+	}
+	if (--spipending == 0) {
+		Sched_SetState(SPI_TC_WORK, 2, 0);
+	}
+}
 
-			tmp = xfer.data[2] << 8 | xfer.data[3];
-			spiextrareadout[i] = tmp;
+// Queues a transfer of len bytes for each polled device, returns how many are in flight
+static uint8_t SPI_TC_StartAll( uint8_t len ) {
+	spipending = 0;
+	for (int i = 0; i < MAX_SPI_DEVICES; i++) {
+		if (!(spipollmask & (1 << i))) continue;
+		spixfers[i].ssmask = 1 << i;
+		spixfers[i].len = len; // Doesn't matter what data contains when sending, MOSI not connected
+		if (SC18IS602B_SPI_Start(&spixfers[i], SPI_TC_XferDone) == 0) {
+			spipending++;
 		}
 	}
-	return TICKS_MS(100);
+	return spipending;
+}
+
+// All devices are handed to the bridge at once, SPI_TC_XferDone wakes us up when they're done
+static int32_t SPI_TC_Work( void ) {
+	switch (spiacquiring) {
+		case SPI_TRIGGER:
+			// Only live devices are read, except for an occasional look for new ones
+			spipollmask = spipresent;
+			if ((Sched_GetMs() - spiprobems) >= SPI_REPROBE_MS) {
+				spipollmask = (1 << MAX_SPI_DEVICES) - 1;
+				spiprobems = Sched_GetMs();
+			}
+			if (spipollmask == 0) {
+				spiacquiring = SPI_READING;
+				return 0;
+			}
+			// Clock out a single byte from each device, this restarts their conversions
+			spiacquiring = SPI_TRIGGERING;
+			if (SPI_TC_StartAll(1)) {
+				return -1;
+			}
+			// Fall through
+		case SPI_TRIGGERING:
+			spiconvms = Sched_GetMs();
+			spiacquiring = SPI_CONVERTING;
+			return TICKS_MS(MAX31855_CONV_MS);
+		case SPI_CONVERTING:
+			spiacquiring = SPI_READING;
+			if (SPI_TC_StartAll(4)) { // 32 bits from TC interface
+				return -1;
+			}
+			// Fall through
+		case SPI_READING:
+			spiacquiring = SPI_IDLE;
+			Sched_SetState(spinotify, 2, 0);
+			return -1;
+		default:
+			return -1;
+	}
 }
 
 uint32_t SPI_TC_Init(void) {
@@ -60,40 +190,46 @@ uint32_t SPI_TC_Init(void) {
 
 	// Only continue of we find the I2C to SPI bridge chip
 	if (SC18IS602B_Init(SPICLK_1843KHZ, SPIMODE_0, SPIORDER_MSBFIRST) >= 0) {
+		spibridge = 1;
 		printf("\nProbing for MAX31855 devices...");
 
-		// Assume all devices are present for SPI_TC_Work
-		numspidevices = MAX_SPI_DEVICES;
-
-		// Run one iteration to update all data
-		SPI_TC_Work();
-
-		// And reset it afterwards
-		numspidevices = 0;
-
-		for (int i = 0; i < MAX_SPI_DEVICES; i++) {
-			if ((spidevreadout[i] == -1 && spiextrareadout[i] == -1) ||
-			    (spidevreadout[i] == 0 && spiextrareadout[i] == 0)) {
-				//printf(" Unknown/Invalid/Absent device");
-			} else {
-				printf("\nSS%x: [SPI Thermocouple interface]", i);
-				// A bit of a hack as it assumes all earlier devices are present
-				numspidevices = i + 1;
-			}
+		// Devices read all zeroes until their first conversion after power-up is done
+		uint32_t nowms = Sched_GetMs();
+		if (nowms < MAX31855_CONV_MS) {
+			BusyWait(TICKS_MS(1) * (MAX31855_CONV_MS - nowms));
 		}
 
-		if (numspidevices) {
-			 // Enable SPI TC task if there's at least one device
-			Sched_SetState(SPI_TC_WORK, 2, 0);
-		} else {
+		SPI_TC_ReadAll();
+
+		if (spipresent == 0) {
 			printf(" No MAX31855 devices found!");
 		}
 	}
-	return numspidevices;
+	return __builtin_popcount(spipresent);
+}
+
+/*
+ * Restarts the conversion on all devices and reads them back once it's done,
+ * notify is woken up after that. Every SPI_REPROBE_MS all slave selects are
+ * read to pick up newly connected devices. Returns -1 if there is no bridge
+ * or the previous acquisition is still running.
+ */
+int32_t SPI_TC_Acquire(Task_t notify) {
+	if (!spibridge || spiacquiring) {
+		return -1;
+	}
+	spiacquiring = SPI_TRIGGER;
+	spinotify = notify;
+	Sched_SetState(SPI_TC_WORK, 2, 0);
+	return 0;
+}
+
+int SPI_TC_IsAcquiring(void) {
+	return spiacquiring;
 }
 
 int SPI_IsTCPresent(uint8_t tcid) {
-	if (tcid < numspidevices) {
+	if (tcid < MAX_SPI_DEVICES && (spipresent & (1 << tcid))) {
 		if (!(spidevreadout[tcid] & 0x01)) {
 			 // A faulty/not connected TC will not be flagged as present
 			 return 1;
@@ -102,30 +238,39 @@ int SPI_IsTCPresent(uint8_t tcid) {
 	return 0;
 }
 
-float SPI_GetTCReading(uint8_t tcid) {
+// MAX31855_FAULT_* bits, 0 if the thermocouple is fine or there is no device
+uint8_t SPI_GetTCFault(uint8_t tcid) {
+	return (tcid < MAX_SPI_DEVICES && (spipresent & (1 << tcid))) ? spifaults[tcid] : 0;
+}
+
+// Readings are in 1/16 degC, the native resolution of the MAX31855
+int16_t SPI_GetTCReading(uint8_t tcid) {
 	// Report 0C for missing sensors
-	float retval = 0.0f;
-	if (tcid < numspidevices) {
+	int16_t retval = 0;
+	if (tcid < MAX_SPI_DEVICES && (spipresent & (1 << tcid))) {
 		if (spidevreadout[tcid] & 0x01) { // Fault detected
 			retval = INVALID_VALUE;
 		} else {
-			retval = (float)(spidevreadout[tcid] & 0xfffc); // Mask reserved bit
-			retval /= 16;
+			retval = spidevreadout[tcid] & ~0x03; // Mask reserved bit
 		}
 	}
 	return retval;
 }
 
-float SPI_GetTCColdReading(uint8_t tcid) {
+int16_t SPI_GetTCColdReading(uint8_t tcid) {
 	// Report 0C for missing sensors
-	float retval = 0.0f;
-	if (tcid < numspidevices) {
+	int16_t retval = 0;
+	if (tcid < MAX_SPI_DEVICES && (spipresent & (1 << tcid))) {
 		if (spiextrareadout[tcid] & 0x07) { // Any fault detected
 			retval = INVALID_VALUE;
 		} else {
-			retval = (float)(spiextrareadout[tcid] & 0xfff0); // Mask reserved/fault bits
-			retval /= 256;
+			retval = spiextrareadout[tcid] >> 4; // 1/256 degC with the reserved/fault bits below
 		}
 	}
 	return retval;
 }
+
+// Time in ms (see Sched_GetMs) the current readout was converted, 0 if there is none
+uint64_t SPI_GetTCTimestamp(uint8_t tcid) {
+	return (tcid < MAX_SPI_DEVICES && (spipresent & (1 << tcid))) ? spisamplems[tcid] : 0;
+}
@@ -1,9 +1,21 @@
 #ifndef MAX31855_H_
 #define MAX31855_H_
 
+#include "sched.h"
+
+// Thermocouple faults, D2-D0 of the MAX31855 frame
+#define MAX31855_FAULT_OC (1 << 0) // Open circuit
+#define MAX31855_FAULT_SCG (1 << 1) // Shorted to GND
+#define MAX31855_FAULT_SCV (1 << 2) // Shorted to VCC
+#define MAX31855_FAULT_MASK (0x07)
+
 uint32_t SPI_TC_Init(void);
 int SPI_IsTCPresent(uint8_t tcid);
-float SPI_GetTCReading(uint8_t tcid);
-float SPI_GetTCColdReading(uint8_t tcid);
+uint8_t SPI_GetTCFault(uint8_t tcid);
+int16_t SPI_GetTCReading(uint8_t tcid);
+int16_t SPI_GetTCColdReading(uint8_t tcid);
+uint64_t SPI_GetTCTimestamp(uint8_t tcid);
+int32_t SPI_TC_Acquire(Task_t notify);
+int SPI_TC_IsAcquiring(void);
 
 #endif /* MAX31855_H_ */
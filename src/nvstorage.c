@@ -58,6 +58,7 @@ void NV_Init(void) {
 	}
 #ifndef MINIMALISTIC
 	Sched_SetWorkfunc(NV_WORK,NV_Work);
+	Sched_SetPriority(NV_WORK, SCHED_PRIO_BACKGROUND);
 	Sched_SetState(NV_WORK, 1, 0);
 #endif
 }
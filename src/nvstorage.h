@@ -14,6 +14,18 @@ typedef enum eNVItem {
 	REFLOW_MIN_FAN_SPEED,
 	REFLOW_BAKE_SETPOINT_H,
 	REFLOW_BAKE_SETPOINT_L,
+	PID_KP_H, // Kp * 100
+	PID_KP_L,
+	PID_KI_H, // Ki * 10000
+	PID_KI_L,
+	PID_KD_H, // Kd * 100
+	PID_KD_L,
+	TELEMETRY_INTERVAL, // Serial logging interval in TELEMETRY_INTERVAL_UNITs
+	REFLOW_FF_GAIN, // Heater feedforward, PWM counts per C/s of profile ramp
+	REFLOW_MPC, // 1 to follow profiles with the model predictive controller instead of the PID
+	MPC_GAIN, // Oven model: steady state rise above ambient at full heat, in 2C units
+	MPC_TAU, // Oven model: time constant, in 2s units
+	MPC_DEADTIME, // Oven model: dead time, in 0.1s units
 	NVITEM_NUM_ITEMS // Last value
 } NVItem_t;
 
@@ -1,5 +1,5 @@
 /*
- * onewire.c - Bitbang 1-wire DS18B20 temp-sensor handling for T-962 reflow controller
+ * onewire.c - Interrupt-driven 1-wire DS18B20 temp-sensor handling for T-962 reflow controller
  *
  * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
  *
@@ -26,65 +26,6 @@
 #include "sched.h"
 #include "vic.h"
 
-static inline void setpin0() {
-	FIO0CLR = (1<<7);
-	FIO0DIR |= (1<<7);
-}
-
-static inline void setpin1() {
-	FIO0SET = (1<<7);
-	FIO0DIR |= (1<<7);
-}
-
-static inline void setpinhiz() {
-	FIO0DIR &= ~(1<<7);
-}
-
-static inline uint32_t getpin() {
-	return !!(FIO0PIN & (1<<7));
-}
-
-static inline uint32_t xferbyte(uint32_t thebyte) {
-	for (uint32_t bits = 0; bits < 8; bits++) {
-		setpin0();
-		BusyWait(TICKS_US(1.5)); // 1.5us
-		if (thebyte&0x01) setpinhiz();
-		thebyte >>= 1;
-		BusyWait(TICKS_US(13));
-		if (getpin()) thebyte |= 0x80;
-		BusyWait(TICKS_US(45));
-		setpinhiz();
-		BusyWait(TICKS_US(10));
-	}
-	return thebyte;
-}
-
-static inline uint32_t xferbit(uint32_t thebit) {
-	setpin0();
-	BusyWait(TICKS_US(1.5));
-	if (thebit) setpinhiz();
-	thebit = 0;
-	BusyWait(TICKS_US(13));
-	if (getpin()) thebit = 0x01;
-	BusyWait(TICKS_US(45));
-	setpinhiz();
-	BusyWait(TICKS_US(10));
-	return thebit;
-}
-
-static inline uint32_t resetbus(void) {
-	uint32_t devicepresent = 0;
-
-	setpin0();
-	BusyWait(TICKS_US(480));
-	setpinhiz();
-	BusyWait(TICKS_US(70));
-	if (getpin() == 0) devicepresent = 1;
-	BusyWait(TICKS_US(410));
-
-	return devicepresent;
-}
-
 #define OW_SEARCH_ROM (0xf0)
 #define OW_READ_ROM (0x33)
 #define OW_MATCH_ROM (0x55)
@@ -98,13 +39,32 @@ static inline uint32_t resetbus(void) {
 #define OW_FAMILY_TC (0x3b)
 
 #define MAX_OW_DEVICES (5)
+#define OW_INVALID_VALUE (999 * 16) // 1/16 degC like the readings
 static uint8_t owdeviceids[MAX_OW_DEVICES][8]; // uint64_t results in really odd code
 static int16_t devreadout[MAX_OW_DEVICES]; // Keeps last readout from each device
 static int16_t extrareadout[MAX_OW_DEVICES]; // Keeps last readout from each device
+static uint64_t devsamplems[MAX_OW_DEVICES]; // When the last readout was converted
 static int numowdevices = 0;
 static int8_t tcidmapping[16]; // Map TC ID to ROM ID index
 static int8_t tempidx; // Which ROM ID index that contains the temperature sensor
 
+#define OW_SCRATCHPAD_LEN (9) // Eight data bytes and their CRC
+#define OW_READ_RETRIES (2) // Extra attempts at a readout before keeping the last good one
+
+// Per-device readout health, latency is in Timer0 ticks from the first attempt to a good readout
+typedef struct {
+	uint32_t good;
+	uint32_t crcerrors;
+	uint32_t noresponse; // No presence pulse
+	uint32_t late; // A slot was sampled after the data stopped being valid
+	uint32_t retries;
+	uint32_t failures; // All attempts failed, last good readout kept
+	uint32_t maxlatency;
+	uint64_t totallatency;
+	uint64_t lastgoodms;
+} OneWireStats_t;
+static OneWireStats_t owstats[MAX_OW_DEVICES];
+
 // OW functions from Application note 187 (modified for readability)
 // global search state
 static uint8_t ROM_NO[8];
@@ -145,92 +105,338 @@ static uint8_t docrc8(uint8_t value) {
 	return crc8;
 }
 
+/*
+ * A scratchpad is valid when the CRC over all nine bytes comes out as zero.
+ * Byte 5 is reserved and reads 0xff on all supported parts, checking it too
+ * catches the all-zero readout of a bus stuck low (which has a valid CRC) and
+ * most multi-bit errors slipping past the CRC on a really noisy bus.
+ */
+static int scratchpadvalid(const uint8_t* scratch) {
+	crc8 = 0;
+	for (int i = 0; i < OW_SCRATCHPAD_LEN; i++) {
+		docrc8(scratch[i]);
+	}
+	return crc8 == 0 && scratch[5] == 0xff;
+}
+
+/*
+ * All bus timing is done by Timer1 match interrupts, each one handles a single
+ * edge or sample point of a reset or time slot and sets up the match for the
+ * next one. The CPU and other interrupts are free in between, the only busy
+ * wait left is the 1.5us low pulse at the start of read and write-1 slots
+ * which is shorter than another interrupt round trip would be.
+ *
+ * A transaction is an optional reset/presence cycle, a number of bytes written,
+ * a number of bytes read back into the same buffer after the written ones, and
+ * optionally the 64 search triplets of a Search ROM. It's started from task
+ * context, when it's done the ONEWIRE_WORK task is posted and calls the done
+ * callback, or it's waited for synchronously during initialization. The result
+ * is 0, -1 without a presence pulse, or -2 when a search ran out of devices or a
+ * slot interrupt came too late to sample the bus.
+ */
+
+// Timer1 runs at PCLK for sub-microsecond resolution
+#define OW_TICKS_US(x) ((uint32_t)((((double)x * (double)PCLKFREQ) / (1000.0f * 1000.0f)) + 0.5f))
+
+#define OW_RESET_US (480)
+#define OW_PRESENCE_US (70) // Sample point after releasing the bus
+#define OW_SLOT_LOW_US (1.5)
+#define OW_SLOT_SAMPLE_US (12) // Slaves keep their data valid for 15us, leave some margin for IRQ latency
+#define OW_SLOT_VALID_US (15)
+#define OW_SLOT_US (60)
+#define OW_RECOVERY_US (10)
+
+#define OW_XFER_RESET (1 << 0) // Reset and presence detect first
+#define OW_XFER_SEARCH (1 << 1) // Search ROM triplets follow the written and read bytes
+#define OW_XFER_PULLUP (1 << 2) // Actively drive the bus high when done to power a conversion
+
+#define OW_EVENT_DONE (1 << 0)
+
+#define OW_XFER_BUFSIZE (20) // Match ROM plus command plus a full scratchpad
+
+// Returns the delay until OneWire_Work should run again, or -1 to wait for the next event
+typedef int32_t (*OneWireDone_t)(int32_t result);
+
+typedef enum {
+	OW_IDLE = 0,
+	OW_RESET_RELEASE,
+	OW_RESET_PRESENCE,
+	OW_RESET_DONE,
+	OW_SLOT_START,
+	OW_SLOT_SAMPLE,
+	OW_SLOT_END,
+} OWPhase_t;
+
+static volatile OWPhase_t owphase = OW_IDLE;
+static volatile int32_t owresult;
+static OneWireDone_t owdone;
+static uint8_t owbuf[OW_XFER_BUFSIZE]; // Written bytes followed by the bytes read
+static uint8_t owflags;
+static uint16_t owbit; // Current bit of the written and read bytes
+static uint16_t owtxbits;
+static uint16_t owtotalbits;
+static uint8_t owpresence;
+static uint8_t ownbit; // Search ROM bit and which part of its triplet
+static uint8_t owtriplet;
+static uint8_t owidbit;
+static int owlastzero;
+static uint32_t owt; // Start of the current reset or slot in Timer1 ticks
+
+static inline void setpin0() {
+	FIO0CLR = (1<<7);
+	FIO0DIR |= (1<<7);
+}
+
+static inline void setpin1() {
+	FIO0SET = (1<<7);
+	FIO0DIR |= (1<<7);
+}
+
+static inline void setpinhiz() {
+	FIO0DIR &= ~(1<<7);
+}
+
+static inline uint32_t getpin() {
+	return !!(FIO0PIN & (1<<7));
+}
+
+// Sets up the match for the next bus event, if that time has already passed the
+// interrupt fires right away instead of after a full wrap of the timer
+static void OneWire_At(uint32_t when) {
+	uint32_t now = T1TC;
+	if ((int32_t)(when - now) < (int32_t)OW_TICKS_US(1)) {
+		when = now + OW_TICKS_US(1);
+	}
+	T1MR0 = when;
+}
+
+// Bit to send in the next slot, reads are write-1 slots
+static uint8_t OneWire_SlotBit(void) {
+	if (owbit < owtxbits) {
+		return (owbuf[owbit >> 3] >> (owbit & 7)) & 1;
+	} else if (owbit < owtotalbits || owtriplet < 2) {
+		return 1;
+	}
+	return (ROM_NO[ownbit >> 3] >> (ownbit & 7)) & 1; // Search direction
+}
+
+// The two reads of a search triplet decide the direction written in the third slot,
+// see Application note 187. Returns -1 if no device is left participating.
+static int32_t OneWire_SearchSampled(uint8_t bit) {
+	if (owtriplet == 0) {
+		owidbit = bit;
+		return 0;
+	}
+	if (owidbit && bit) {
+		return -1;
+	}
+	int id_bit_number = ownbit + 1;
+	uint8_t rom_byte_mask = 1 << (ownbit & 7);
+	uint8_t search_direction;
+	if (owidbit != bit) {
+		search_direction = owidbit; // All devices coupled have 0 or 1
+	} else {
+		// Discrepancy, pick the same as last time before the last discrepancy
+		// and 1 at it, 0 (recorded in last zero) otherwise
+		if (id_bit_number < LastDiscrepancy) {
+			search_direction = ((ROM_NO[ownbit >> 3] & rom_byte_mask) > 0);
+		} else {
+			search_direction = (id_bit_number == LastDiscrepancy);
+		}
+		if (search_direction == 0) {
+			owlastzero = id_bit_number;
+			if (owlastzero < 9) {
+				LastFamilyDiscrepancy = owlastzero;
+			}
+		}
+	}
+	if (search_direction == 1) {
+		ROM_NO[ownbit >> 3] |= rom_byte_mask;
+	} else {
+		ROM_NO[ownbit >> 3] &= ~rom_byte_mask;
+	}
+	return 0;
+}
+
+static int32_t OneWire_SlotDone(uint8_t bit) {
+	if (owbit < owtxbits) {
+		owbit++;
+	} else if (owbit < owtotalbits) {
+		if (bit) {
+			owbuf[owbit >> 3] |= 1 << (owbit & 7);
+		} else {
+			owbuf[owbit >> 3] &= ~(1 << (owbit & 7));
+		}
+		owbit++;
+	} else {
+		if (owtriplet < 2 && OneWire_SearchSampled(bit)) {
+			return -1;
+		}
+		if (++owtriplet == 3) {
+			owtriplet = 0;
+			ownbit++;
+		}
+	}
+	return 0;
+}
+
+static void OneWire_Finish(int32_t result) {
+	if (result == 0 && (owflags & OW_XFER_PULLUP)) {
+		setpin1();
+	} else if (result) {
+		setpinhiz(); // Aborted mid slot, a write-0 would otherwise keep the bus low
+	}
+	owresult = result;
+	owphase = OW_IDLE;
+	T1MCR = 0x00;
+	if (owdone) {
+		Sched_PostFromISR(ONEWIRE_WORK, OW_EVENT_DONE, 0);
+	}
+}
+
+// Handles the current bus event and sets up the next one
+static void OneWire_Step(void) {
+	switch (owphase) {
+		case OW_RESET_RELEASE:
+			setpinhiz();
+			owt = T1TC;
+			OneWire_At(owt + OW_TICKS_US(OW_PRESENCE_US));
+			owphase = OW_RESET_PRESENCE;
+			break;
+		case OW_RESET_PRESENCE:
+			owpresence = !getpin();
+			OneWire_At(owt + OW_TICKS_US(OW_RESET_US));
+			owphase = OW_RESET_DONE;
+			break;
+		case OW_RESET_DONE:
+			if (!owpresence) {
+				OneWire_Finish(-1);
+				return;
+			}
+			// Fall through, the first slot follows right away
+		case OW_SLOT_START: {
+			if (owbit == owtotalbits && (!(owflags & OW_XFER_SEARCH) || ownbit == 64)) {
+				OneWire_Finish(0);
+				return;
+			}
+			uint8_t bit = OneWire_SlotBit();
+			setpin0();
+			owt = T1TC;
+			if (bit) {
+				while ((T1TC - owt) < OW_TICKS_US(OW_SLOT_LOW_US));
+				setpinhiz();
+			}
+			OneWire_At(owt + OW_TICKS_US(OW_SLOT_SAMPLE_US));
+			owphase = OW_SLOT_SAMPLE;
+			break;
+		}
+		case OW_SLOT_SAMPLE:
+			// Another interrupt may have held this one off past the point where the
+			// slave still drives the bus, what the pin reads then means nothing.
+			// Only matters for slots that are read, write slots just get longer.
+			if (owbit >= owtxbits && (owbit < owtotalbits || owtriplet < 2) &&
+			    (T1TC - owt) >= OW_TICKS_US(OW_SLOT_VALID_US)) {
+				OneWire_Finish(-2);
+				return;
+			}
+			if (OneWire_SlotDone(getpin())) {
+				OneWire_Finish(-2);
+				return;
+			}
+			OneWire_At(owt + OW_TICKS_US(OW_SLOT_US));
+			owphase = OW_SLOT_END;
+			break;
+		case OW_SLOT_END:
+			setpinhiz();
+			OneWire_At(T1TC + OW_TICKS_US(OW_RECOVERY_US));
+			owphase = OW_SLOT_START;
+			break;
+		default:
+			break;
+	}
+}
+
+static void __attribute__ ((interrupt ("IRQ"))) OneWire_IRQHandler(void) {
+	T1IR = 0x01; // ACK MR0 match
+	OneWire_Step();
+	VICVectAddr = 0; // ACK irq
+}
+
+// Starts a transaction in the background, the done callback is called from OneWire_Work.
+// Returns -1 if the bus is busy or the transfer doesn't fit in the buffer.
+static int32_t OneWire_Start(uint8_t flags, const uint8_t* tx, uint8_t numtx, uint8_t numrx, OneWireDone_t done) {
+	if (owphase != OW_IDLE || numtx + numrx > OW_XFER_BUFSIZE) {
+		return -1;
+	}
+	memcpy(owbuf, tx, numtx);
+	owflags = flags;
+	owdone = done;
+	owbit = 0;
+	owtxbits = numtx * 8;
+	owtotalbits = (numtx + numrx) * 8;
+	ownbit = 0;
+	owtriplet = 0;
+	owlastzero = 0;
+	owresult = 0;
+
+	T1IR = 0x01;
+	if (flags & OW_XFER_RESET) {
+		owphase = OW_RESET_RELEASE;
+		setpin0();
+		owt = T1TC;
+		T1MR0 = owt + OW_TICKS_US(OW_RESET_US);
+	} else {
+		owphase = OW_SLOT_START;
+		T1MR0 = T1TC + OW_TICKS_US(1);
+	}
+	T1MCR = 0x01; // Interrupt on MR0 match
+	return 0;
+}
+
+// Runs a transaction to completion, only used during initialization
+static int32_t OneWire_Xfer(uint8_t flags, const uint8_t* tx, uint8_t numtx, uint8_t numrx) {
+	if (OneWire_Start(flags, tx, numtx, numrx, NULL)) {
+		return -1;
+	}
+	while (owphase != OW_IDLE) {
+		// With IRQs masked the match interrupt still wakes the core up, see Sched_Sleep
+		uint32_t save = VIC_DisableIRQ();
+		if (owphase != OW_IDLE) {
+			PCON = 0x01; // Idle mode until the next bus event
+		}
+		VIC_RestoreIRQ(save);
+	}
+	return owresult;
+}
+
 /* Perform the 1-Wire Search Algorithm on the 1-Wire bus using the existing
  * search state.
  * Return TRUE : device found, ROM number in ROM_NO buffer
  * FALSE : device not found, end of search
  */
 static int OWSearch() {
-	int id_bit_number;
-	int last_zero, rom_byte_number, search_result;
-	int id_bit, cmp_id_bit;
-	uint8_t rom_byte_mask, search_direction;
-
-	// initialize for search
-	id_bit_number = 1;
-	last_zero = 0;
-	rom_byte_number = 0;
-	rom_byte_mask = 1;
-	search_result = 0;
-	crc8 = 0;
+	static const uint8_t searchcmd = OW_SEARCH_ROM;
+	int search_result = 0;
+
 	// if the last call was not the last one
 	if (!LastDeviceFlag) {
-		// 1-Wire reset
-		if (!resetbus()) { // No devices found
+		// 1-Wire reset, the search command and all triplets in one go
+		int32_t result = OneWire_Xfer(OW_XFER_RESET | OW_XFER_SEARCH, &searchcmd, 1, 0);
+		if (result == -1) { // No devices found
 			// reset the search
 			LastDiscrepancy = 0;
 			LastDeviceFlag = false;
 			LastFamilyDiscrepancy = 0;
 			return false;
 		}
-		// issue the search command
-		xferbyte(OW_SEARCH_ROM);
-		// loop to do the search
-		do {
-			// read a bit and its complement
-			id_bit = xferbit( true );
-			cmp_id_bit = xferbit( true );
-			// check for no devices on 1-wire
-			if ((id_bit == 1) && (cmp_id_bit == 1)) {
-				break;
-			} else {
-				// all devices coupled have 0 or 1
-				if (id_bit != cmp_id_bit) {
-					search_direction = id_bit; // bit write value for search
-				} else {
-					// if this discrepancy if before the Last Discrepancy
-					// on a previous next then pick the same as last time
-					if (id_bit_number < LastDiscrepancy) {
-						search_direction = ((ROM_NO[rom_byte_number] & rom_byte_mask) > 0);
-					} else {
-						// if equal to last pick 1, if not then pick 0
-						search_direction = (id_bit_number == LastDiscrepancy);
-					}
-					// if 0 was picked then record its position in LastZero
-					if (search_direction == 0) {
-						last_zero = id_bit_number;
-						// check for Last discrepancy in family
-						if (last_zero < 9) {
-							LastFamilyDiscrepancy = last_zero;
-						}
-					}
-				}
-				// set or clear the bit in the ROM byte rom_byte_number
-				// with mask rom_byte_mask
-				if (search_direction == 1) {
-					ROM_NO[rom_byte_number] |= rom_byte_mask;
-				} else {
-					ROM_NO[rom_byte_number] &= ~rom_byte_mask;
-				}
-				// serial number search direction write bit
-				xferbit(search_direction);
-				// increment the byte counter id_bit_number
-				// and shift the mask rom_byte_mask
-				id_bit_number++;
-				rom_byte_mask <<= 1;
-				// if the mask is 0 then go to new SerialNum byte rom_byte_number and reset mask
-				if (rom_byte_mask == 0) {
-					docrc8(ROM_NO[rom_byte_number]); // accumulate the CRC
-					rom_byte_number++;
-					rom_byte_mask = 1;
-				}
-			}
-		} while(rom_byte_number < 8); // loop until through all ROM bytes 0-7
-
+		crc8 = 0;
+		for (int i = 0; i < 8; i++) {
+			docrc8(ROM_NO[i]); // accumulate the CRC
+		}
 		// if the search was successful then
-		if (!((id_bit_number < 65) || (crc8 != 0))) {
+		if (result == 0 && crc8 == 0) {
 			// search successful so set LastDiscrepancy,LastDeviceFlag,search_result
-			LastDiscrepancy = last_zero;
+			LastDiscrepancy = owlastzero;
 			// check for last device
 			if (LastDiscrepancy == 0) {
 				LastDeviceFlag = true;
@@ -271,57 +477,144 @@ static int OWNext() {
 	return OWSearch();
 }
 
-static void selectdevbyidx(int idx) {
-	if (idx < numowdevices) {
-		resetbus();
-		xferbyte(OW_MATCH_ROM);
-		for (int idloop = 0; idloop < 8; idloop++) { // Send ROM device ID
-			xferbyte(owdeviceids[idx][idloop]);
-		}
+
+// Puts Match ROM for the device into buf, returns the number of bytes
+static uint8_t selectdevbyidx(int idx, uint8_t* buf) {
+	buf[0] = OW_MATCH_ROM;
+	memcpy(&buf[1], owdeviceids[idx], 8); // Send ROM device ID
+	return 9;
+}
+
+static uint8_t owacquiring = 0;
+static Task_t ownotify;
+static uint64_t owconvms; // Start of the current conversion
+static uint8_t owstate = 0;
+static uint8_t owreadidx = 0;
+static uint8_t owattempt = 0;
+static uint32_t owreadstart;
+
+static int32_t OneWire_ReadDone(int32_t result);
+
+// Conversion and readout of all devices is over, successful or not
+static int32_t OneWire_Acquired(void) {
+	owstate = 0;
+	owacquiring = 0;
+	Sched_SetState(ownotify, 2, 0);
+	return -1;
+}
+
+static int32_t OneWire_StartRead(void) {
+	uint8_t cmd[10];
+	uint8_t len = selectdevbyidx(owreadidx, cmd);
+	cmd[len++] = OW_READ_SCRATCHPAD;
+	if (owattempt == 0) {
+		owreadstart = Sched_GetTick();
 	}
+	OneWire_Start(OW_XFER_RESET, cmd, len, OW_SCRATCHPAD_LEN, OneWire_ReadDone);
+	return -1;
 }
 
-static int32_t OneWire_Work(void) {
-	static uint8_t mystate = 0;
-	uint8_t scratch[9];
-	int32_t retval = 0;
+static int32_t OneWire_ReadDone(int32_t result) {
+	OneWireStats_t* st = &owstats[owreadidx];
+	uint8_t* scratch = &owbuf[10];
+
+	if (result == -2) {
+		st->late++;
+	} else if (result) {
+		st->noresponse++;
+	} else if (!scratchpadvalid(scratch)) {
+		st->crcerrors++;
+		result = -1;
+	} else {
+		int16_t tmp = scratch[1]<<8 | scratch[0];
+		devreadout[owreadidx] = tmp;
+		devsamplems[owreadidx] = owconvms;
+		tmp = scratch[3]<<8 | scratch[2];
+		extrareadout[owreadidx] = tmp;
+
+		uint32_t latency = Sched_GetTick() - owreadstart;
+		st->good++;
+		st->totallatency += latency;
+		if (latency > st->maxlatency) st->maxlatency = latency;
+		st->lastgoodms = Sched_GetMs();
+	}
 
-	if (mystate == 0) {
-		uint32_t save = VIC_DisableIRQ();
-		if (resetbus()) {
-			xferbyte(OW_SKIP_ROM); // All devices on the bus are addressed here
-			xferbyte(OW_CONVERT_T);
-			setpin1();
-			//retval = TICKS_MS(94); // For 9-bit resolution
-			retval = TICKS_MS(100); // TC interface needs max 100ms to be ready
-			mystate++;
+	if (result) {
+		if (owattempt < OW_READ_RETRIES) {
+			owattempt++;
+			st->retries++;
+			return OneWire_StartRead();
 		}
-		VIC_RestoreIRQ( save );
-	} else if (mystate == 1) {
+		st->failures++; // Hold on to the last good readout
+	}
+
+	owattempt = 0;
+	if (++owreadidx < numowdevices) {
+		return OneWire_StartRead();
+	}
+	return OneWire_Acquired();
+}
+
+static int32_t OneWire_ConvertDone(int32_t result) {
+	if (result) {
 		for (int i = 0; i < numowdevices; i++) {
-			uint32_t save = VIC_DisableIRQ();
-			selectdevbyidx(i);
-			xferbyte(OW_READ_SCRATCHPAD);
-			for (uint32_t iter = 0; iter < 4; iter++) { // Read four bytes
-				scratch[iter] = xferbyte(0xff);
+			if (result == -2) {
+				owstats[i].late++;
+			} else {
+				owstats[i].noresponse++;
 			}
-			VIC_RestoreIRQ(save);
-			int16_t tmp = scratch[1]<<8 | scratch[0];
-			devreadout[i] = tmp;
-			tmp = scratch[3]<<8 | scratch[2];
-			extrareadout[i] = tmp;
+			owstats[i].failures++;
 		}
-		mystate = 0;
-	} else {
-		retval = -1;
+		return OneWire_Acquired(); // Nobody answered the reset or a slot came too late, keep the last readouts
 	}
+	owconvms = Sched_GetMs();
+	owstate = 1;
+	//return TICKS_MS(94); // For 9-bit resolution
+	return TICKS_MS(100); // TC interface needs max 100ms to be ready
+}
 
-	return retval;
+static int32_t OneWire_Work(void) {
+	static const uint8_t convertcmd[] = {
+		OW_SKIP_ROM, // All devices on the bus are addressed here
+		OW_CONVERT_T
+	};
+
+	if (Sched_GetEvents(ONEWIRE_WORK) & OW_EVENT_DONE) {
+		OneWireDone_t done = owdone;
+		owdone = NULL;
+		if (done) {
+			return done(owresult);
+		}
+	}
+	if (owphase != OW_IDLE || !owacquiring) {
+		return -1; // Woken up by the completion event or OneWire_Acquire
+	}
+
+	if (owstate == 0) {
+		OneWire_Start(OW_XFER_RESET | OW_XFER_PULLUP, convertcmd, sizeof(convertcmd), 0, OneWire_ConvertDone);
+	} else {
+		owreadidx = 0;
+		owattempt = 0;
+		OneWire_StartRead();
+	}
+	return -1;
 }
 
 uint32_t OneWire_Init(void) {
+	uint8_t cmd[OW_XFER_BUFSIZE];
+	uint8_t len;
+
 	printf("\n%s called", __FUNCTION__);
 	Sched_SetWorkfunc(ONEWIRE_WORK, OneWire_Work);
+
+	T1CTCR = 0; // Normal timer mode
+	T1PR = 0; // Full PCLK resolution for the bus timing
+	T1TCR = 0x02; // Reset timer
+	T1TCR = 0x01; // Enable timer
+	T1MCR = 0x00; // MR0 match interrupt is only enabled during transactions
+	VIC_RegisterHandler(VIC_TIMER1, OneWire_IRQHandler);
+	VIC_EnableHandler(VIC_TIMER1);
+
 	printf("\nScanning 1-wire bus...");
 
 	tempidx = -1; // Assume we don't find a temperature sensor
@@ -329,17 +622,13 @@ uint32_t OneWire_Init(void) {
 		tcidmapping[i] = -1; // Assume we don't find any thermocouple interfaces
 	}
 
-	uint32_t save = VIC_DisableIRQ();
 	int rslt = OWFirst();
-	VIC_RestoreIRQ( save );
 
 	numowdevices = 0;
 	while (rslt && numowdevices < MAX_OW_DEVICES) {
 		memcpy(owdeviceids[numowdevices], ROM_NO, sizeof(ROM_NO));
 		numowdevices++;
-		save = VIC_DisableIRQ();
 		rslt = OWNext();
-		VIC_RestoreIRQ( save );
 	}
 
 	if (numowdevices) {
@@ -358,25 +647,29 @@ uint32_t OneWire_Init(void) {
 				} else if (family == OW_FAMILY_TEMP3) {
 					sensorname = "DS18S20";
 				}
-				save = VIC_DisableIRQ();
-				selectdevbyidx(iter);
-				xferbyte(OW_WRITE_SCRATCHPAD);
-				xferbyte(0x00);
-				xferbyte(0x00);
-				xferbyte(0x1f); // Reduce resolution to 0.5C to keep conversion time reasonable
-				VIC_RestoreIRQ(save);
+				len = selectdevbyidx(iter, cmd);
+				cmd[len++] = OW_WRITE_SCRATCHPAD;
+				cmd[len++] = 0x00;
+				cmd[len++] = 0x00;
+				cmd[len++] = 0x1f; // Reduce resolution to 0.5C to keep conversion time reasonable
+				OneWire_Xfer(OW_XFER_RESET, cmd, len, 0);
 				tempidx = iter; // Keep track of where we saw the last/only temperature sensor
 				printf(" [%s Temperature sensor]", sensorname);
 			} else if (family == OW_FAMILY_TC) {
-				save = VIC_DisableIRQ();
-				selectdevbyidx(iter);
-				xferbyte(OW_READ_SCRATCHPAD);
-				xferbyte(0xff);
-				xferbyte(0xff);
-				xferbyte(0xff);
-				xferbyte(0xff);
-				uint8_t tcid = xferbyte(0xff) & 0x0f;
-				VIC_RestoreIRQ( save );
+				len = selectdevbyidx(iter, cmd);
+				cmd[len++] = OW_READ_SCRATCHPAD;
+				int32_t result = -1;
+				for (int attempt = 0; attempt <= OW_READ_RETRIES && result; attempt++) {
+					result = OneWire_Xfer(OW_XFER_RESET, cmd, len, OW_SCRATCHPAD_LEN);
+					if (result == 0 && !scratchpadvalid(&owbuf[len])) {
+						result = -1;
+					}
+				}
+				if (result) {
+					printf(" [Thermocouple interface, unreadable]");
+					continue;
+				}
+				uint8_t tcid = owbuf[len + 4] & 0x0f;
 				tcidmapping[tcid] = iter; // Keep track of the ID mapping
 				printf(" [Thermocouple interface, ID %x]",tcid);
 			}
@@ -385,20 +678,58 @@ uint32_t OneWire_Init(void) {
 		printf(" No devices found!");
 	}
 
-	if (numowdevices) {
-		Sched_SetState(ONEWIRE_WORK, 2, 0); // Enable OneWire task if there's at least one device
-	}
 	return numowdevices;
 }
 
-float OneWire_GetTempSensorReading(void) {
-	float retval = 999.0f; // Report invalid temp if not found
+/*
+ * Starts a conversion on all devices at once followed by reading them back,
+ * notify is woken up when it's all done. Readouts that fail keep their
+ * previous value and timestamp. Returns -1 if there are no devices or the
+ * previous acquisition is still running.
+ */
+int32_t OneWire_Acquire(Task_t notify) {
+	if (numowdevices == 0 || owacquiring) {
+		return -1;
+	}
+	owacquiring = 1;
+	ownotify = notify;
+	owstate = 0;
+	Sched_SetState(ONEWIRE_WORK, 2, 0);
+	return 0;
+}
+
+int OneWire_IsAcquiring(void) {
+	return owacquiring;
+}
+
+void OneWire_ListStats(void) {
+	uint64_t now = Sched_GetMs();
+	printf("\n%-16s %8s %7s %7s %7s %7s %7s %8s %8s %8s", "Device", "Good", "CRCErr",
+	       "NoResp", "Late", "Retries", "Failed", "LatAvg", "LatMax", "Age");
+	for (int i = 0; i < numowdevices; i++) {
+		OneWireStats_t* st = &owstats[i];
+		printf("\n");
+		for (int idloop = 7; idloop >= 0; idloop--) {
+			printf("%02x", owdeviceids[i][idloop]);
+		}
+		printf(" %8u %7u %7u %7u %7u %7u", (unsigned int)st->good, (unsigned int)st->crcerrors,
+		       (unsigned int)st->noresponse, (unsigned int)st->late, (unsigned int)st->retries,
+		       (unsigned int)st->failures);
+		if (st->good) {
+			printf(" %8u %8u %8u", (unsigned int)Sched_TicksToUs(st->totallatency / st->good),
+			       (unsigned int)Sched_TicksToUs(st->maxlatency), (unsigned int)(now - st->lastgoodms));
+		} else {
+			printf(" %8s %8s %8s", "-", "-", "-");
+		}
+	}
+	printf("\n(latency in us from the first attempt, age of the last good readout in ms)\n");
+}
+
+// Readings are in 1/16 degC, the native resolution of the sensors
+int16_t OneWire_GetTempSensorReading(void) {
+	int16_t retval = OW_INVALID_VALUE; // Report invalid temp if not found
 	if(tempidx >= 0) {
-		retval = (float)devreadout[tempidx];
-		retval /= 16;
-		//printf(" (%.1f C)",retval);
-	} else {
-		//printf(" (%.1f C assumed)",retval);
+		retval = devreadout[tempidx];
 	}
 	return retval;
 }
@@ -413,36 +744,44 @@ int OneWire_IsTCPresent(uint8_t tcid) {
 	return 0;
 }
 
-float OneWire_GetTCReading(uint8_t tcid) {
-	float retval = 0.0f; // Report 0C for missing sensors
+int16_t OneWire_GetTCReading(uint8_t tcid) {
+	int16_t retval = 0; // Report 0C for missing sensors
 	if (tcid < sizeof(tcidmapping)) {
 		uint8_t idx = tcidmapping[tcid];
 		if (idx >=0) { // Is this ID present?
 			if (devreadout[idx] & 0x01) { // Fault detected
-				retval = 999.0f; // Invalid
+				retval = OW_INVALID_VALUE;
 			} else {
-				retval = (float)(devreadout[idx] & 0xfffc); // Mask reserved bit
-				retval /= 16;
-				//printf(" (%x=%.1f C)",tcid,retval);
+				retval = devreadout[idx] & ~0x03; // Mask reserved bit
 			}
 		}
 	}
 	return retval;
 }
 
-float OneWire_GetTCColdReading(uint8_t tcid) {
-	float retval = 0.0f; // Report 0C for missing sensors
+int16_t OneWire_GetTCColdReading(uint8_t tcid) {
+	int16_t retval = 0; // Report 0C for missing sensors
 	if (tcid < sizeof(tcidmapping)) {
 		uint8_t idx = tcidmapping[tcid];
 		if (idx >=0) { // Is this ID present?
 			if (extrareadout[idx] & 0x07) { // Any fault detected
-				retval = 999.0f; // Invalid
+				retval = OW_INVALID_VALUE;
 			} else {
-				retval = (float)(extrareadout[idx] & 0xfff0); // Mask reserved/fault bits
-				retval /= 256;
-				//printf(" (%x=%.1f C)",tcid,retval);
+				retval = extrareadout[idx] >> 4; // 1/256 degC with the reserved/fault bits below
 			}
 		}
 	}
 	return retval;
 }
+
+// Time in ms (see Sched_GetMs) the current readout was converted, 0 if there is none
+uint64_t OneWire_GetTempSensorTimestamp(void) {
+	return tempidx >= 0 ? devsamplems[tempidx] : 0;
+}
+
+uint64_t OneWire_GetTCTimestamp(uint8_t tcid) {
+	if (tcid < sizeof(tcidmapping) && tcidmapping[tcid] >= 0) {
+		return devsamplems[tcidmapping[tcid]];
+	}
+	return 0;
+}
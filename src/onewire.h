@@ -1,11 +1,18 @@
 #ifndef ONEWIRE_H_
 #define ONEWIRE_H_
 
+#include "sched.h"
+
 uint32_t OneWire_Init( void );
 int OneWire_PerformTemperatureConversion(void);
-float OneWire_GetTempSensorReading(void);
+int16_t OneWire_GetTempSensorReading(void);
 int OneWire_IsTCPresent(uint8_t tcid);
-float OneWire_GetTCReading(uint8_t tcid);
-float OneWire_GetTCColdReading(uint8_t tcid);
+int16_t OneWire_GetTCReading(uint8_t tcid);
+int16_t OneWire_GetTCColdReading(uint8_t tcid);
+void OneWire_ListStats(void);
+int32_t OneWire_Acquire(Task_t notify);
+int OneWire_IsAcquiring(void);
+uint64_t OneWire_GetTempSensorTimestamp(void);
+uint64_t OneWire_GetTCTimestamp(uint8_t tcid);
 
 #endif /* ONEWIRE_H_ */
@@ -0,0 +1,140 @@
+/*
+ * profilexfer.c - Binary reflow profile upload/download over the serial port
+ *
+ * Copyright (C) 2014 Werner Johansson, wj@unifiedengineering.se
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "serial.h"
+#include "sched.h"
+#include "reflow_profiles.h"
+#include "profilexfer.h"
+
+/*
+ * A frame is STX, a length byte, a profile record (see reflow_profiles.h) and a
+ * CRC-16/CCITT (polynomial 0x1021, initial value 0xffff) over the length byte and
+ * the record, most significant byte first.
+ *
+ * "profile get <id>" answers with a "Profile <id>" line followed by a frame.
+ * "profile put <id>" answers with a "Ready for profile <id>" line, takes a frame and
+ * then reports if the profile was stored. Any profile can be read, only custom ones
+ * can be written.
+ */
+#define XFER_STX (0x02)
+#define XFER_OVERHEAD (4)
+
+// Give up on an upload when the host goes quiet
+#define XFER_TIMEOUT_MS (5000)
+
+static uint8_t frame[PROFILE_RECORD_MAX + XFER_OVERHEAD];
+static uint32_t framelen = 0;
+static int putprofile = -1;
+static uint64_t lastrx = 0;
+
+static uint16_t ProfileXfer_CRC16(const uint8_t* buf, uint32_t len) {
+	uint16_t crc = 0xffff;
+	while (len--) {
+		crc ^= *buf++ << 8;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+void ProfileXfer_Get(int profile) {
+	int32_t len = Reflow_GetProfileRecord(profile, frame + 2);
+	if (len == -2) {
+		printf("\nProfile %d is too steep to send as segments\n", profile);
+		return;
+	}
+	if (len < 0) {
+		printf("\nNo profile with id: %d\n", profile);
+		return;
+	}
+	frame[0] = XFER_STX;
+	frame[1] = len;
+	uint16_t crc = ProfileXfer_CRC16(frame + 1, len + 1);
+	frame[len + 2] = crc >> 8;
+	frame[len + 3] = crc;
+
+	printf("\nProfile %d\n", profile);
+	uart_writebin(frame, len + XFER_OVERHEAD);
+	printf("\n");
+}
+
+void ProfileXfer_StartPut(int profile) {
+	int numprofiles = Reflow_GetNumProfiles();
+	if (profile < numprofiles - PROFILE_NUM_CUSTOM || profile >= numprofiles) {
+		printf("\nOnly custom profiles %d-%d can be written\n", numprofiles - PROFILE_NUM_CUSTOM, numprofiles - 1);
+		return;
+	}
+	putprofile = profile;
+	framelen = 0;
+	lastrx = Sched_GetMs();
+	printf("\nReady for profile %d\n", profile);
+}
+
+int ProfileXfer_IsReceiving(void) {
+	return putprofile >= 0;
+}
+
+static void ProfileXfer_Store(void) {
+	uint32_t len = frame[1];
+	uint16_t crc = (frame[len + 2] << 8) | frame[len + 3];
+	if (crc != ProfileXfer_CRC16(frame + 1, len + 1)) {
+		printf("\nProfile transfer failed, bad CRC\n");
+		return;
+	}
+
+	int32_t retval = Reflow_PutProfileRecord(putprofile, frame + 2, len);
+	if (retval == -2) {
+		printf("\nProfile transfer failed, invalid profile\n");
+	} else if (retval == -3) {
+		printf("\nProfile transfer failed, out of EEPROM space\n");
+	} else if (retval) {
+		printf("\nProfile transfer failed, EEPROM write error\n");
+	} else {
+		printf("\nProfile %d stored, %u segments\n", putprofile, frame[2]);
+	}
+}
+
+// Collects the frame of an upload, called instead of the command parser while receiving
+void ProfileXfer_Work(void) {
+	uint64_t now = Sched_GetMs();
+
+	while (putprofile >= 0 && uart_isrxready()) {
+		uint8_t ch = uart_readc();
+		lastrx = now;
+		if (framelen == 0 && ch != XFER_STX) {
+			continue; // Leftovers from the command line
+		}
+		frame[framelen++] = ch;
+		if (framelen == 2 && frame[1] > PROFILE_RECORD_MAX) {
+			printf("\nProfile transfer failed, frame too long\n");
+			putprofile = -1;
+		} else if (framelen > 2 && framelen == frame[1] + XFER_OVERHEAD) {
+			ProfileXfer_Store();
+			putprofile = -1;
+		}
+	}
+
+	if (putprofile >= 0 && now - lastrx > XFER_TIMEOUT_MS) {
+		printf("\nProfile transfer timed out\n");
+		putprofile = -1;
+	}
+}
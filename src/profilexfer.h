@@ -0,0 +1,9 @@
+#ifndef PROFILEXFER_H_
+#define PROFILEXFER_H_
+
+void ProfileXfer_Get(int profile);
+void ProfileXfer_StartPut(int profile);
+int ProfileXfer_IsReceiving(void);
+void ProfileXfer_Work(void);
+
+#endif /* PROFILEXFER_H_ */
@@ -20,11 +20,11 @@
 #include "LPC214x.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <math.h>
 #include "t962.h"
 #include "reflow_profiles.h"
 #include "io.h"
 #include "lcd.h"
-#include "rtc.h"
 #include "PID_v1.h"
 #include "sched.h"
 #include "nvstorage.h"
@@ -34,35 +34,113 @@
 // Standby temperature in degrees Celsius
 #define STANDBYTEMP (50)
 
-// 250ms between each run
-#define PID_TIMEBASE (250)
-
-#define TICKS_PER_SECOND (1000 / PID_TIMEBASE)
+// Gains used until an autotune run has stored better ones in NV
+#define PID_DEFAULT_KP (20.0f)
+#define PID_DEFAULT_KI (0.016f)
+#define PID_DEFAULT_KD (62.5f)
+
+// Relay feedback autotuning: the heater is switched fully on below
+// AUTOTUNE_SETPOINT - AUTOTUNE_HYST and off above AUTOTUNE_SETPOINT + AUTOTUNE_HYST.
+// The first AUTOTUNE_SETTLE cycles are discarded, the following AUTOTUNE_CYCLES
+// are averaged. Gives up if that hasn't happened in AUTOTUNE_TIMEOUT seconds.
+#define AUTOTUNE_HEAT (255)
+#define AUTOTUNE_HYST (1.0f)
+#define AUTOTUNE_HYST_FIXED ((int32_t)(AUTOTUNE_HYST * SENSOR_TEMP_SCALE))
+#define AUTOTUNE_SETTLE (1)
+#define AUTOTUNE_CYCLES (3)
+#define AUTOTUNE_TIMEOUT (20 * 60)
+
+// Wake the UI this often while a cycle is running
+#define UI_REFRESH_MS (500)
+
+// Model predictive control: the tracking error is evaluated at MPC_HORIZON points
+// MPC_STEP seconds apart, starting one dead time ahead. MPC_HISTORY seconds of model
+// output are kept to cover the longest dead time the MPC_DEADTIME setting allows.
+#define MPC_STEP (1.0f)
+#define MPC_HORIZON (12)
+#define MPC_HISTORY (32)
 
 static PidType PID;
 
 static uint16_t intsetpoint;
-static int bake_timer = 0;
+static uint32_t bake_timer = 0; // ms, 0 means no timer
 
-static float avgtemp;
+static int32_t avgtemp; // 1/SENSOR_TEMP_SCALE degC
 
 static uint8_t reflowdone = 0;
 static ReflowMode_t mymode = REFLOW_STANDBY;
-static uint16_t numticks = 0;
+static uint64_t elapsedms = 0; // Time spent in the current mode, bake only counts at setpoint
+static int32_t lastfeedforward = 0; // PID output limits are offset by this much
 
 static int standby_logging = 0;
 
+// Latest state of the control loop, only written by Reflow_Work.
+// Tasks don't preempt each other so readers always see a consistent copy.
+static struct {
+	ReflowMode_t mode;
+	const char* modestr;
+	uint64_t elapsedms;
+	int32_t temp[4]; // 1/SENSOR_TEMP_SCALE degC, converted for printing only
+	int32_t avgtemp;
+	int32_t coldjunction;
+	uint16_t setpoint;
+	uint8_t heat;
+	uint8_t fan;
+} snapshot = { REFLOW_INITIAL };
+
+static struct {
+	uint8_t heating;
+	uint8_t cycle; // Completed relay cycles, including the discarded ones
+	int32_t maxtemp;
+	int32_t mintemp;
+	float sumamplitude;
+	uint64_t lastonms; // Time the heater was last switched on
+	uint64_t sumperiodms;
+	uint64_t sumonms; // Heater on time during the averaged cycles
+} autotune;
+
+// First order plus dead time oven model, running without the dead time
+static struct {
+	float model; // Model temperature
+	float history[MPC_HISTORY]; // Model temperature at the last MPC_HISTORY whole seconds
+	uint8_t historyidx;
+	uint32_t lastsecond;
+	uint32_t lastms; // Profile time of the last model step
+	uint8_t active; // MPC drove the outputs last time, the PID has to pick up from there
+	uint8_t heat, fan; // Outputs applied by MPC last time
+	float tau; // Time constant decay[] was calculated for
+	float decay[MPC_HORIZON]; // exp(-t/tau) for each prediction point
+} mpc;
+
+static int32_t Reflow_Autotune(uint64_t nowms, int32_t meastemp, uint8_t* pheat, uint8_t* pfan);
+static void Reflow_ResetMPC(int32_t meastemp);
+static int32_t Reflow_MPC(uint32_t thetime, int32_t meastemp, uint8_t* pheat, uint8_t* pfan);
+
 static int32_t Reflow_Work(void) {
 	static ReflowMode_t oldmode = REFLOW_INITIAL;
 	static uint32_t lasttick = 0;
+	static uint64_t lastms = 0;
+	static uint8_t uirefresh = 0;
 	uint8_t fan, heat;
-	uint32_t ticks = RTC_Read();
+	uint64_t nowms = Sched_GetMs();
 
 	Sensor_DoConversion();
-	avgtemp = Sensor_GetTemp(TC_AVERAGE);
+	avgtemp = Sensor_GetTempFixed(TC_AVERAGE);
 
 	const char* modestr = "UNKNOWN";
 
+	if (mymode != oldmode) {
+		oldmode = mymode;
+		elapsedms = 0;
+		Reflow_ResetMPC(avgtemp);
+	} else if (mymode == REFLOW_REFLOW || mymode == REFLOW_AUTOTUNE ||
+	           (mymode == REFLOW_BAKE && !Reflow_IsPreheating())) {
+		// Measure the actual time between runs instead of assuming PID_TIMEBASE
+		elapsedms += nowms - lastms;
+		uirefresh++;
+	}
+	lastms = nowms;
+
 	// Depending on mode we should run this with different parameters
 	if (mymode == REFLOW_STANDBY || mymode == REFLOW_STANDBYFAN) {
 		intsetpoint = STANDBYTEMP;
@@ -71,7 +149,7 @@ static int32_t Reflow_Work(void) {
 		heat = 0;
 
 		// Suppress slow-running fan in standby
-		if (mymode == REFLOW_STANDBY && avgtemp < (float)STANDBYTEMP) {
+		if (mymode == REFLOW_STANDBY && avgtemp < STANDBYTEMP * SENSOR_TEMP_SCALE) {
 			 fan = 0;
 		}
 		modestr = "STANDBY";
@@ -81,51 +159,53 @@ static int32_t Reflow_Work(void) {
 		modestr = "BAKE";
 
 	} else if(mymode == REFLOW_REFLOW) {
-		reflowdone = Reflow_Run(ticks, avgtemp, &heat, &fan, 0) ? 1 : 0;
+		reflowdone = Reflow_Run((uint32_t)elapsedms, avgtemp, &heat, &fan, 0) ? 1 : 0;
 		modestr = "REFLOW";
 
+	} else if(mymode == REFLOW_AUTOTUNE) {
+		intsetpoint = AUTOTUNE_SETPOINT;
+		if (!reflowdone) {
+			reflowdone = Reflow_Autotune(elapsedms, avgtemp, &heat, &fan) ? 1 : 0;
+		} else {
+			heat = 0;
+			fan = NV_GetConfig(REFLOW_MIN_FAN_SPEED);
+		}
+		modestr = "AUTOTUNE";
+
 	} else {
 		heat = fan = 0;
 	}
 	Set_Heater(heat);
 	Set_Fan(fan);
 
-	if (mymode != oldmode) {
-		printf("\n# Time,  Temp0, Temp1, Temp2, Temp3,  Set,Actual, Heat, Fan,  ColdJ, Mode");
-		oldmode = mymode;
-		numticks = 0;
-	} else if (mymode == REFLOW_BAKE) {
-		if (bake_timer > 0 && numticks >= bake_timer) {
+	if (mymode == REFLOW_BAKE) {
+		if (bake_timer > 0 && elapsedms >= bake_timer) {
 			printf("\n DONE baking, set bake timer to 0.");
 			bake_timer = 0;
 			Reflow_SetMode(REFLOW_STANDBY);
 		}
 
-		// start increasing ticks after setpoint is reached...
-		if (avgtemp < intsetpoint && bake_timer > 0) {
+		// The bake timer only starts counting after setpoint is reached...
+		if (Reflow_IsPreheating()) {
 			modestr = "BAKE-PREHEAT";
-		} else {
-			numticks++;
 		}
-	} else if (mymode == REFLOW_REFLOW) {
-		numticks++;
 	}
 
-	if (!(mymode == REFLOW_STANDBY && standby_logging == 0)) {
-		printf("\n%6.1f,  %5.1f, %5.1f, %5.1f, %5.1f,  %3u, %5.1f,  %3u, %3u,  %5.1f, %s",
-		       ((float)numticks / TICKS_PER_SECOND),
-		       Sensor_GetTemp(TC_LEFT),
-		       Sensor_GetTemp(TC_RIGHT),
-		       Sensor_GetTemp(TC_EXTRA1),
-		       Sensor_GetTemp(TC_EXTRA2),
-		       intsetpoint, avgtemp,
-		       heat, fan,
-		       Sensor_GetTemp(TC_COLD_JUNCTION),
-		       modestr);
-	}
-
-	if (numticks & 1) {
-		// Force UI refresh every other cycle
+	snapshot.mode = mymode;
+	snapshot.modestr = modestr;
+	snapshot.elapsedms = elapsedms;
+	snapshot.temp[0] = Sensor_GetTempFixed(TC_LEFT);
+	snapshot.temp[1] = Sensor_GetTempFixed(TC_RIGHT);
+	snapshot.temp[2] = Sensor_GetTempFixed(TC_EXTRA1);
+	snapshot.temp[3] = Sensor_GetTempFixed(TC_EXTRA2);
+	snapshot.avgtemp = avgtemp;
+	snapshot.coldjunction = Sensor_GetTempFixed(TC_COLD_JUNCTION);
+	snapshot.setpoint = intsetpoint;
+	snapshot.heat = heat;
+	snapshot.fan = fan;
+
+	if (uirefresh >= UI_REFRESH_MS / PID_TIMEBASE) {
+		uirefresh = 0;
 		Sched_SetState(MAIN_WORK, 2, 0);
 	}
 
@@ -143,8 +223,35 @@ static int32_t Reflow_Work(void) {
 	return nexttick;
 }
 
+// Logs the control loop state over serial, at a lower rate than the loop itself runs
+static int32_t Telemetry_Work(void) {
+	static ReflowMode_t oldmode = REFLOW_INITIAL;
+
+	if (snapshot.mode != oldmode) {
+		printf("\n# Time,  Temp0, Temp1, Temp2, Temp3,  Set,Actual, Heat, Fan,  ColdJ, Mode");
+		oldmode = snapshot.mode;
+	}
+
+	if (snapshot.mode != REFLOW_INITIAL && !(snapshot.mode == REFLOW_STANDBY && standby_logging == 0)) {
+		printf("\n%6.1f,  %5.1f, %5.1f, %5.1f, %5.1f,  %3u, %5.1f,  %3u, %3u,  %5.1f, %s",
+		       ((float)snapshot.elapsedms / 1000.0f),
+		       (float)snapshot.temp[0] / SENSOR_TEMP_SCALE,
+		       (float)snapshot.temp[1] / SENSOR_TEMP_SCALE,
+		       (float)snapshot.temp[2] / SENSOR_TEMP_SCALE,
+		       (float)snapshot.temp[3] / SENSOR_TEMP_SCALE,
+		       snapshot.setpoint, (float)snapshot.avgtemp / SENSOR_TEMP_SCALE,
+		       snapshot.heat, snapshot.fan,
+		       (float)snapshot.coldjunction / SENSOR_TEMP_SCALE,
+		       snapshot.modestr);
+	}
+	return TICKS_MS(TELEMETRY_INTERVAL_UNIT) * NV_GetConfig(TELEMETRY_INTERVAL); // Constant folds, no soft-double
+}
+
 void Reflow_Init(void) {
 	Sched_SetWorkfunc(REFLOW_WORK, Reflow_Work);
+	Sched_SetPriority(REFLOW_WORK, SCHED_PRIO_REALTIME);
+	Sched_SetWorkfunc(TELEMETRY_WORK, Telemetry_Work);
+	Sched_SetPriority(TELEMETRY_WORK, SCHED_PRIO_BACKGROUND);
 	//PID_init(&PID, 10, 0.04, 5, PID_Direction_Direct); // This does not reach the setpoint fast enough
 	//PID_init(&PID, 30, 0.2, 5, PID_Direction_Direct); // This reaches the setpoint but oscillates a bit especially during cooling
 	//PID_init(&PID, 30, 0.2, 15, PID_Direction_Direct); // This overshoots the setpoint
@@ -153,7 +260,7 @@ void Reflow_Init(void) {
 	//PID_init(&PID, 20, 0.04, 25, PID_Direction_Direct); // Improvement as far as I can tell, still work in progress
 	PID_init(&PID, 0, 0, 0, PID_Direction_Direct); // Can't supply tuning to PID_Init when not using the default timebase
 	PID_SetSampleTime(&PID, PID_TIMEBASE);
-	PID_SetTunings(&PID, 20, 0.016, 62.5); // Adjusted values to compensate for the incorrect timebase earlier
+	//PID_SetTunings(&PID, 20, 0.016, 62.5); // Adjusted values to compensate for the incorrect timebase earlier, now PID_DEFAULT_*
 	//PID_SetTunings(&PID, 80, 0, 0); // This results in oscillations with 14.5s cycle time
 	//PID_SetTunings(&PID, 30, 0, 0); // This results in oscillations with 14.5s cycle time
 	//PID_SetTunings(&PID, 15, 0, 0);
@@ -168,21 +275,50 @@ void Reflow_Init(void) {
 
 	Reflow_ValidateNV();
 	Sensor_ValidateNV();
+	Reflow_LoadTunings();
 
 	Reflow_LoadSetpoint();
 
-	PID.mySetpoint = (float)SETPOINT_DEFAULT;
+	PID.mySetpoint = PID_FROM_INT(SETPOINT_DEFAULT);
 	PID_SetOutputLimits(&PID, 0, 255 + 248);
+	lastfeedforward = 0;
 	PID_SetMode(&PID, PID_Mode_Manual);
-	PID.myOutput = 248; // Between fan and heat
+	PID.myInput = PID_FROM_FIXED(Sensor_GetTempFixed(TC_AVERAGE), SENSOR_TEMP_FRACBITS); // No derivative kick from a zero input
+	PID.myOutput = PID_FROM_INT(248); // Between fan and heat
 	PID_SetMode(&PID, PID_Mode_Automatic);
-	RTC_Zero();
 
 	// Start work
 	Sched_SetState(REFLOW_WORK, 2, 0);
+	Sched_SetState(TELEMETRY_WORK, 2, 0);
+}
+
+// Bumpless transfer: restart the PID with its output where the heater and fan actually
+// were, not wherever it wound up to while the output was overridden (standby never heats)
+static void Reflow_TrackOutputs(uint8_t heat, uint8_t fan) {
+	int32_t out = 248; // Between fan and heat
+	if (heat > 0) {
+		out = 248 + heat;
+	} else if (fan > 255 - 248) {
+		out = 255 - fan;
+	}
+	PID_SetMode(&PID, PID_Mode_Manual);
+	PID.myOutput = PID_FROM_INT(out - lastfeedforward);
+	PID_SetMode(&PID, PID_Mode_Automatic);
 }
 
 void Reflow_SetMode(ReflowMode_t themode) {
+	if (themode != mymode) {
+		Reflow_TrackOutputs(snapshot.heat, snapshot.fan);
+	}
+	if (themode == REFLOW_AUTOTUNE && mymode != REFLOW_AUTOTUNE) {
+		autotune.heating = 1;
+		autotune.cycle = 0;
+		autotune.lastonms = 0;
+		autotune.sumamplitude = 0.0f;
+		autotune.sumperiodms = 0;
+		autotune.sumonms = 0;
+		reflowdone = 0;
+	}
 	mymode = themode;
 	// reset reflowdone if mode is set to standby.
 	if (themode == REFLOW_STANDBY)  {
@@ -207,7 +343,7 @@ void Reflow_LoadSetpoint(void) {
 }
 
 int16_t Reflow_GetActualTemp(void) {
-	return (int)Sensor_GetTemp(TC_AVERAGE);
+	return Sensor_GetTempFixed(TC_AVERAGE) / SENSOR_TEMP_SCALE;
 }
 
 uint8_t Reflow_IsDone(void) {
@@ -219,73 +355,91 @@ uint16_t Reflow_GetSetpoint(void) {
 }
 
 void Reflow_SetBakeTimer(int seconds) {
-	// reset ticks to 0 when adjusting timer.
-	numticks = 0;
-	bake_timer = seconds * TICKS_PER_SECOND;
+	// reset elapsed time to 0 when adjusting timer.
+	elapsedms = 0;
+	bake_timer = (uint32_t)seconds * 1000;
 }
 
 int Reflow_IsPreheating(void) {
-	return bake_timer > 0 && avgtemp < intsetpoint;
+	return bake_timer > 0 && avgtemp < intsetpoint * SENSOR_TEMP_SCALE;
 }
 
 int Reflow_GetTimeLeft(void) {
 	if (bake_timer == 0) {
 		return -1;
 	}
-	return (bake_timer - numticks) / TICKS_PER_SECOND;
+	if (elapsedms >= bake_timer) {
+		return 0;
+	}
+	return (bake_timer - (uint32_t)elapsedms) / 1000;
 }
 
-// returns -1 if the reflow process is done.
-int32_t Reflow_Run(uint32_t thetime, float meastemp, uint8_t* pheat, uint8_t* pfan, int32_t manualsetpoint) {
+// Seconds since the current reflow or bake started
+int Reflow_GetTimeElapsed(void) {
+	return (int)(elapsedms / 1000);
+}
+
+// thetime is in ms since the start of the profile, meastemp in 1/SENSOR_TEMP_SCALE degC.
+// Returns -1 if the reflow process is done.
+int32_t Reflow_Run(uint32_t thetime, int32_t meastemp, uint8_t* pheat, uint8_t* pfan, int32_t manualsetpoint) {
 	int32_t retval = 0;
+	int32_t feedforward = 0;
 
 	if (manualsetpoint) {
-		PID.mySetpoint = (float)manualsetpoint;
+		PID.mySetpoint = PID_FROM_INT(manualsetpoint);
 
 		if (bake_timer > 0 && (Reflow_GetTimeLeft() == 0 || Reflow_GetTimeLeft() == -1)) {
 			retval = -1;
 		}
-	} else {
-		// Figure out what setpoint to use from the profile, brute-force way. Fix this.
-		uint8_t idx = thetime / 10;
-		uint16_t start = idx * 10;
-		uint16_t offset = thetime - start;
-		if (idx < (NUMPROFILETEMPS - 2)) {
-			uint16_t value = Reflow_GetSetpointAtIdx(idx);
-			uint16_t value2 = Reflow_GetSetpointAtIdx(idx + 1);
-
-			if (value > 0 && value2 > 0) {
-				uint16_t avg = (value * (10 - offset) + value2 * offset) / 10;
-
-				// Keep the setpoint for the UI...
-				intsetpoint = avg;
-				if (value2 > avg) {
-					// Temperature is rising,
-					// using the future value for PID regulation produces better result when heating
-					PID.mySetpoint = (float)value2;
-				} else {
-					// Use the interpolated value when cooling
-					PID.mySetpoint = (float)avg;
-				}
-			} else {
-				retval = -1;
-			}
-		} else {
-			retval = -1;
+	} else if (thetime < Reflow_GetProfileDuration()) {
+		int32_t setpoint = Reflow_GetProfileSetpoint(thetime);
+
+		// Keep the setpoint for the UI...
+		intsetpoint = (setpoint + PROFILE_TEMP_SCALE / 2) >> PROFILE_TEMP_FRACBITS;
+		PID.mySetpoint = PID_FROM_FIXED(setpoint, PROFILE_TEMP_FRACBITS);
+
+		// Heat needed to follow the ramp of the profile, the PID only has to make up
+		// for losses and model error. No feedforward when cooling, the fan isn't
+		// linear enough for that.
+		int32_t slope = Reflow_GetProfileSlope(thetime);
+		if (slope > 0) {
+			feedforward = (slope * NV_GetConfig(REFLOW_FF_GAIN)) >> PROFILE_TEMP_FRACBITS;
 		}
+	} else {
+		retval = -1;
 	}
 
-	if (!manualsetpoint) {
-		// Plot actual temperature on top of desired profile
-		int realx = (thetime / 5) + XAXIS;
-		int y = (uint16_t)(meastemp * 0.2f);
+	// Plot actual temperature on top of desired profile, as far as the graph goes
+	if (!manualsetpoint && thetime < NUMPROFILETEMPS * PROFILE_STEP_SECS * 1000) {
+		int realx = (thetime / 5000) + XAXIS;
+		int y = (uint16_t)(meastemp / (5 * SENSOR_TEMP_SCALE));
 		y = YAXIS - y;
 		LCD_SetPixel(realx, y);
 	}
 
-	PID.myInput = meastemp;
+	// Shift the PID output range by the feedforward so the sum stays within 0 - 255+248,
+	// that way the integrator can't wind up against a limit the PID alone doesn't see
+	if (feedforward != lastfeedforward) {
+		PID_SetOutputLimits(&PID, 0 - feedforward, 255 + 248 - feedforward);
+		lastfeedforward = feedforward;
+	}
+
+	if (!manualsetpoint && NV_GetConfig(REFLOW_MPC) == 1 && Reflow_MPC(thetime, meastemp, pheat, pfan) == 0) {
+		mpc.active = 1;
+		mpc.heat = *pheat;
+		mpc.fan = *pfan;
+		return retval;
+	}
+
+	PID.myInput = PID_FROM_FIXED(meastemp, SENSOR_TEMP_FRACBITS);
+	if (mpc.active) {
+		// The PID hasn't seen the input while MPC was in control, restart it from
+		// the current temperature and the outputs MPC left behind
+		mpc.active = 0;
+		Reflow_TrackOutputs(mpc.heat, mpc.fan);
+	}
 	PID_Compute(&PID);
-	uint32_t out = PID.myOutput;
+	uint32_t out = PID_TO_INT(PID.myOutput) + feedforward;
 	if (out < 248) { // Fan in reverse
 		*pfan = 255 - out;
 		*pheat = 0;
@@ -301,6 +455,211 @@ int32_t Reflow_Run(uint32_t thetime, float meastemp, uint8_t* pheat, uint8_t* pf
 	return retval;
 }
 
+// For trying out different gains without rebuilding the firmware
+void Reflow_SetTunings(float kp, float ki, float kd) {
+	PID_SetTunings(&PID, kp, ki, kd);
+}
+
+static uint16_t GetNV16(NVItem_t high) {
+	return (NV_GetConfig(high) << 8) | NV_GetConfig(high + 1);
+}
+
+static void SetNV16(NVItem_t high, float value) {
+	uint16_t intval = value > 65534.0f ? 65534 : (uint16_t)(value + 0.5f);
+	NV_SetConfig(high, intval >> 8);
+	NV_SetConfig(high + 1, (uint8_t)intval);
+}
+
+// Uses the gains stored by the last autotune run, or the defaults if there hasn't been one
+void Reflow_LoadTunings(void) {
+	if (GetNV16(PID_KP_H) == 0xffff || GetNV16(PID_KI_H) == 0xffff || GetNV16(PID_KD_H) == 0xffff) {
+		SetNV16(PID_KP_H, PID_DEFAULT_KP * 100.0f);
+		SetNV16(PID_KI_H, PID_DEFAULT_KI * 10000.0f);
+		SetNV16(PID_KD_H, PID_DEFAULT_KD * 100.0f);
+		printf("\nResetting PID gains to default.");
+	}
+	PID_SetTunings(&PID, GetNV16(PID_KP_H) * 0.01f, GetNV16(PID_KI_H) * 0.0001f, GetNV16(PID_KD_H) * 0.01f);
+}
+
+void Reflow_ListTunings(void) {
+	printf("\nPID gains: Kp %.2f, Ki %.4f, Kd %.2f\n", PID.dispKp, PID.dispKi, PID.dispKd);
+}
+
+int Reflow_GetAutotuneCycle(void) {
+	return autotune.cycle;
+}
+
+// Relay feedback experiment, Astrom-Hagglund. Returns -1 when done or aborted
+static int32_t Reflow_Autotune(uint64_t nowms, int32_t meastemp, uint8_t* pheat, uint8_t* pfan) {
+	*pfan = NV_GetConfig(REFLOW_MIN_FAN_SPEED);
+
+	if (nowms > AUTOTUNE_TIMEOUT * 1000ULL) {
+		printf("\nAutotune gave up after %ds, the oven never settled into oscillation", AUTOTUNE_TIMEOUT);
+		*pheat = 0;
+		return -1;
+	}
+
+	if (autotune.heating && meastemp > AUTOTUNE_SETPOINT * SENSOR_TEMP_SCALE + AUTOTUNE_HYST_FIXED) {
+		autotune.heating = 0;
+		if (autotune.lastonms && autotune.cycle >= AUTOTUNE_SETTLE) {
+			autotune.sumonms += nowms - autotune.lastonms;
+		}
+	} else if (!autotune.heating && meastemp < AUTOTUNE_SETPOINT * SENSOR_TEMP_SCALE - AUTOTUNE_HYST_FIXED) {
+		// Heater switching on again completes a cycle
+		autotune.heating = 1;
+		if (autotune.lastonms) {
+			autotune.cycle++;
+			if (autotune.cycle > AUTOTUNE_SETTLE) {
+				autotune.sumamplitude += (float)(autotune.maxtemp - autotune.mintemp) / (2 * SENSOR_TEMP_SCALE);
+				autotune.sumperiodms += nowms - autotune.lastonms;
+			}
+			printf("\nAutotune cycle %d: %.1f - %.1fdegC, %.1fs", autotune.cycle,
+			       (float)autotune.mintemp / SENSOR_TEMP_SCALE, (float)autotune.maxtemp / SENSOR_TEMP_SCALE, (float)(nowms - autotune.lastonms) / 1000.0f);
+		}
+		autotune.lastonms = nowms;
+		autotune.maxtemp = autotune.mintemp = meastemp;
+	}
+
+	if (meastemp > autotune.maxtemp) autotune.maxtemp = meastemp;
+	if (meastemp < autotune.mintemp) autotune.mintemp = meastemp;
+	*pheat = autotune.heating ? AUTOTUNE_HEAT : 0;
+
+	if (autotune.cycle < AUTOTUNE_SETTLE + AUTOTUNE_CYCLES) {
+		return 0;
+	}
+
+	// Describing function of a relay with hysteresis gives the ultimate gain,
+	// the relay output swing is in the same units as the PID output
+	float amplitude = autotune.sumamplitude / AUTOTUNE_CYCLES;
+	float period = (float)autotune.sumperiodms / (1000.0f * AUTOTUNE_CYCLES);
+	float d = AUTOTUNE_HEAT / 2.0f;
+	float ku = 4.0f * d / (3.14159265f * sqrtf(amplitude * amplitude - AUTOTUNE_HYST * AUTOTUNE_HYST));
+	printf("\nAutotune: Ku %.2f, Pu %.1fs", ku, period);
+
+	// Ziegler-Nichols "no overshoot" rule, overshooting a reflow profile is worse than lagging
+	float kp = 0.2f * ku;
+	float ki = kp / (period / 2.0f);
+	float kd = kp * period / 3.0f;
+	if (kp > 655.0f || ki > 6.5f || kd > 655.0f || !(amplitude > AUTOTUNE_HYST)) {
+		printf("\nAutotune result out of range, keeping the previous gains");
+		return -1;
+	}
+	SetNV16(PID_KP_H, kp * 100.0f);
+	SetNV16(PID_KI_H, ki * 10000.0f);
+	SetNV16(PID_KD_H, kd * 100.0f);
+	Reflow_LoadTunings();
+	Reflow_ListTunings();
+	*pheat = 0;
+
+	// The same experiment also identifies a first order plus dead time model for MPC.
+	// The average duty cycle holding the setpoint gives the static gain, the gain
+	// and phase at the ultimate frequency then give the time constant and dead time.
+	float duty = (float)autotune.sumonms / (float)autotune.sumperiodms;
+	float gain = (AUTOTUNE_SETPOINT - Sensor_GetTemp(TC_COLD_JUNCTION)) / (duty * AUTOTUNE_HEAT);
+	float omega = 2.0f * 3.14159265f / period;
+	float tau = sqrtf(gain * ku * gain * ku - 1.0f) / omega;
+	float deadtime = (3.14159265f - atanf(tau * omega)) / omega;
+	printf("\nAutotune: model gain %.0fdegC at full heat, tau %.0fs, dead time %.1fs",
+	       gain * 255.0f, tau, deadtime);
+	if (!(gain * ku > 1.0f) || gain * 255.0f > 508.0f || tau > 508.0f || deadtime > 25.0f) {
+		printf("\nAutotune model out of range, keeping the previous one");
+		return -1;
+	}
+	NV_SetConfig(MPC_GAIN, (uint8_t)(gain * 255.0f / 2.0f + 0.5f));
+	NV_SetConfig(MPC_TAU, (uint8_t)(tau / 2.0f + 0.5f));
+	NV_SetConfig(MPC_DEADTIME, (uint8_t)(deadtime * 10.0f + 0.5f));
+	return -1;
+}
+
+static void Reflow_ResetMPC(int32_t meastemp) {
+	mpc.model = (float)meastemp / SENSOR_TEMP_SCALE;
+	for (int i = 0; i < MPC_HISTORY; i++) {
+		mpc.history[i] = mpc.model;
+	}
+	mpc.historyidx = 0;
+	mpc.lastsecond = 0;
+	mpc.lastms = 0;
+}
+
+// Picks the heater/fan output that, held constant, minimises the squared error between
+// the predicted temperature and the profile over the horizon. The prediction is linear
+// in the output, so the optimum has a closed form costing a few multiplies per point.
+// The model needs exp() and is only run in MPC mode, it stays in floating point.
+// Returns -1 without touching the outputs if the model can't be used, the PID takes over then
+static int32_t Reflow_MPC(uint32_t thetime, int32_t meastemp, uint8_t* pheat, uint8_t* pfan) {
+	float gain = NV_GetConfig(MPC_GAIN) * 2.0f;
+	float tau = NV_GetConfig(MPC_TAU) * 2.0f;
+	float deadtime = NV_GetConfig(MPC_DEADTIME) * 0.1f;
+	float ambient = Sensor_GetTemp(TC_COLD_JUNCTION);
+	uint8_t minfan = NV_GetConfig(REFLOW_MIN_FAN_SPEED);
+	float dt = (thetime - mpc.lastms) / 1000.0f; // Time since the last call, not PID_TIMEBASE
+	mpc.lastms = thetime;
+
+	if (tau == 0.0f) {
+		return -1;
+	}
+
+	if (tau != mpc.tau) {
+		mpc.tau = tau;
+		for (int k = 0; k < MPC_HORIZON; k++) {
+			mpc.decay[k] = expf(-(k + 1) * MPC_STEP / tau);
+		}
+	}
+
+	// Smith predictor: correct the measurement by what the model says the dead time
+	// still hides, that is where the oven is heading with what has already been applied
+	uint8_t whole = (uint8_t)deadtime;
+	float frac = deadtime - whole;
+	float newer = whole ? mpc.history[(mpc.historyidx - whole + MPC_HISTORY) % MPC_HISTORY] : mpc.model;
+	float older = mpc.history[(mpc.historyidx - whole - 1 + MPC_HISTORY) % MPC_HISTORY];
+	float start = (float)meastemp / SENSOR_TEMP_SCALE + mpc.model - (newer + (older - newer) * frac);
+
+	// Predicted temperature at each point is a + b * u
+	float num = 0.0f, den = 0.0f;
+	for (int k = 0; k < MPC_HORIZON; k++) {
+		float a = ambient + (start - ambient) * mpc.decay[k];
+		float b = gain * (1.0f - mpc.decay[k]);
+		uint32_t ahead = (uint32_t)((deadtime + (k + 1) * MPC_STEP) * 1000.0f);
+		float sp = (float)Reflow_GetProfileSetpoint(thetime + ahead) / PROFILE_TEMP_SCALE;
+		num += b * (sp - a);
+		den += b * b;
+	}
+	if (!(den > 0.0f)) { // No gain, the output has no effect on the prediction
+		return -1;
+	}
+	float u = num / den;
+
+	// Below zero means cooling faster than the oven does on its own, that's what the fan is
+	// for. It isn't part of the model, treat it as negative heat of the same scale.
+	if (u > 1.0f) u = 1.0f;
+	if (u < -1.0f) u = -1.0f;
+	if (u >= 0.0f) {
+		*pheat = (uint8_t)(u * 255.0f);
+		*pfan = minfan;
+	} else {
+		*pheat = 0;
+		*pfan = minfan + (uint8_t)(-u * (255 - minfan));
+	}
+
+	mpc.model += (ambient + gain * u - mpc.model) * dt / tau;
+	if (thetime / 1000 != mpc.lastsecond) {
+		mpc.lastsecond = thetime / 1000;
+		mpc.historyidx = (mpc.historyidx + 1) % MPC_HISTORY;
+		mpc.history[mpc.historyidx] = mpc.model;
+	}
+	return 0;
+}
+
+// Restarts the PID at the given temperature with the output halfway between fan and heat,
+// the MPC oven model starts out settled at the same temperature
+void Reflow_ResetPID(int32_t meastemp) {
+	Reflow_ResetMPC(meastemp);
+	PID_SetMode(&PID, PID_Mode_Manual);
+	PID.myInput = PID_FROM_FIXED(meastemp, SENSOR_TEMP_FRACBITS);
+	PID.myOutput = PID_FROM_INT(248); // Between fan and heat
+	PID_SetMode(&PID, PID_Mode_Automatic);
+}
+
 void Reflow_ToggleStandbyLogging(void) {
 	standby_logging = !standby_logging;
 }
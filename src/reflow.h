@@ -6,13 +6,23 @@ typedef enum eReflowMode {
 	REFLOW_STANDBY,
 	REFLOW_BAKE,
 	REFLOW_REFLOW,
-	REFLOW_STANDBYFAN
+	REFLOW_STANDBYFAN,
+	REFLOW_AUTOTUNE
 } ReflowMode_t;
 
 #define SETPOINT_MIN (30)
 #define SETPOINT_MAX (300)
 #define SETPOINT_DEFAULT (30)
 
+// 50ms between each run of the control loop
+#define PID_TIMEBASE (50)
+
+// The TELEMETRY_INTERVAL setting is in these units (ms)
+#define TELEMETRY_INTERVAL_UNIT (50)
+
+// Relay feedback autotuning around this temperature
+#define AUTOTUNE_SETPOINT (150)
+
 // 36 hours max timer
 #define BAKE_TIMER_MAX (60 * 60 * 36)
 
@@ -26,7 +36,13 @@ int Reflow_IsPreheating(void);
 uint16_t Reflow_GetSetpoint(void);
 void Reflow_SetBakeTimer(int seconds);
 int Reflow_GetTimeLeft(void);
-int32_t Reflow_Run(uint32_t thetime, float meastemp, uint8_t* pheat, uint8_t* pfan, int32_t manualsetpoint);
+int Reflow_GetTimeElapsed(void);
+int32_t Reflow_Run(uint32_t thetime, int32_t meastemp, uint8_t* pheat, uint8_t* pfan, int32_t manualsetpoint);
+void Reflow_SetTunings(float kp, float ki, float kd);
+void Reflow_LoadTunings(void);
+void Reflow_ListTunings(void);
+int Reflow_GetAutotuneCycle(void);
+void Reflow_ResetPID(int32_t meastemp);
 void Reflow_ToggleStandbyLogging(void);
 
 #endif /* REFLOW_H_ */
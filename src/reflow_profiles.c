@@ -1,6 +1,7 @@
 #include "LPC214x.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "t962.h"
 #include "lcd.h"
 #include "nvstorage.h"
@@ -12,6 +13,11 @@
 #define RAMPTEST
 #define PIDTEST
 
+// Profiles stored at or above this address are in RAM and may be edited
+#ifndef RAM_START_ADDR
+#define RAM_START_ADDR (0x40000000)
+#endif
+
 extern uint8_t graphbmp[];
 
 // Amtech 4300 63Sn/37Pb leaded profile
@@ -63,12 +69,6 @@ static const profile pidcontrol_testprofile = {
 };
 #endif
 
-// EEPROM profile 1
-static ramprofile ee1 = { "CUSTOM #1" };
-
-// EEPROM profile 2
-static ramprofile ee2 = { "CUSTOM #2" };
-
 static const profile* profiles[] = {
 	&syntechlfprofile,
 	&nc31profile,
@@ -79,15 +79,318 @@ static const profile* profiles[] = {
 #ifdef PIDTEST
 	&pidcontrol_testprofile,
 #endif
-	(profile*) &ee1,
-	(profile*) &ee2
 };
 
-#define NUMPROFILES (sizeof(profiles) / sizeof(profiles[0]))
+#define NUMBUILTINPROFILES (sizeof(profiles) / sizeof(profiles[0]))
+#define NUMPROFILES (NUMBUILTINPROFILES + PROFILE_NUM_CUSTOM)
 
 // current profile index
 static uint8_t profileidx = 0;
 
+/*
+ * Custom profiles are kept in EEPROM as segment lists, in the two areas the NV
+ * settings (at 0x62) leave free. The store starts with a two byte magic followed
+ * by one record per custom profile: a segment count and 3 bytes per segment.
+ *
+ *   byte 0: target temperature bits 7-0
+ *   byte 1: bit 7 target temperature bit 8, bits 6-0 hold time in seconds
+ *   byte 2: ramp rate in 1/PROFILE_RATE_SCALE C/s, 0 steps straight to the target
+ *
+ * The RAM copy below is all the memory the custom profiles use.
+ */
+#define STORE_MAGIC0 ('S')
+#define STORE_MAGIC1 ('1')
+#define STORE_AREA1 (0x00)
+#define STORE_AREA1_LEN (0x62)
+#define STORE_AREA2 (0x80)
+#define STORE_AREA2_LEN (0x80)
+#define STORE_LEN (STORE_AREA1_LEN + STORE_AREA2_LEN)
+
+// Where the original firmware keeps its two 48 x 16-bit tables
+#define LEGACY_PROFILE1 (2)
+#define LEGACY_PROFILE2 (128 + 2)
+
+static uint8_t store[STORE_LEN];
+static uint32_t dirtyfrom = STORE_LEN, dirtyto = 0; // Part of the store not written to EEPROM yet
+
+// Table being edited from the front panel, custom profiles are edited on the 10s grid
+static uint16_t edittemps[NUMPROFILETEMPS];
+static int8_t editslot = -1;
+
+static char customname[12];
+
+// The selected profile as piecewise-linear pieces, collinear pieces are merged.
+// Setpoints are in 1/PROFILE_TEMP_SCALE C, slopes in the same unit per ms scaled by 2^16.
+typedef struct {
+	uint32_t startms;
+	int32_t starttemp;
+	int32_t slope;
+} ProfilePiece_t;
+
+#define MAX_PIECES (64)
+
+static ProfilePiece_t pieces[MAX_PIECES];
+static uint8_t numpieces = 0;
+static uint32_t profileduration = 0; // ms
+static int32_t profileendtemp = 0;
+static uint8_t cursor = 0; // Piece of the last lookup, lookups are mostly close in time
+static int16_t compiledidx = -1; // Profile the pieces belong to, edits recompile on their own
+
+static int Reflow_GetCustomSlot(void) {
+	return profileidx >= NUMBUILTINPROFILES ? profileidx - NUMBUILTINPROFILES : -1;
+}
+
+static void Reflow_AddPiece(uint32_t startms, int32_t starttemp, int32_t slope, uint8_t merge) {
+	if (merge && numpieces && pieces[numpieces - 1].slope == slope) {
+		return; // Continues the previous piece
+	}
+	if (numpieces < MAX_PIECES) {
+		pieces[numpieces].startms = startms;
+		pieces[numpieces].starttemp = starttemp;
+		pieces[numpieces].slope = slope;
+		numpieces++;
+	}
+}
+
+// Each segment needs at most one ramp and one hold piece
+static uint32_t Reflow_CountPieces(const ProfileSegment_t* segs, uint32_t num) {
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < num; i++) {
+		if (i && segs[i].rate && segs[i].target != segs[i - 1].target) count++;
+		if (segs[i].hold) count++;
+	}
+	return count;
+}
+
+static void Reflow_CompileSegments(const ProfileSegment_t* segs, uint32_t num) {
+	uint32_t ms = 0;
+	uint8_t merge = 0;
+
+	numpieces = 0;
+	cursor = 0;
+
+	// A profile starts out at its first target
+	int32_t temp = num ? segs[0].target * PROFILE_TEMP_SCALE : 0;
+
+	for (uint32_t i = 0; i < num; i++) {
+		int32_t target = segs[i].target * PROFILE_TEMP_SCALE;
+		if (target != temp) {
+			if (segs[i].rate) {
+				int32_t delta = target - temp;
+				uint32_t duration = (uint32_t)(delta < 0 ? -delta : delta) *
+						(1000 * PROFILE_RATE_SCALE / PROFILE_TEMP_SCALE) / segs[i].rate;
+				Reflow_AddPiece(ms, temp, (int32_t)(((int64_t)delta << 16) / duration), merge);
+				ms += duration;
+				merge = 1;
+			} else {
+				merge = 0; // Steps don't line up with the previous piece
+			}
+			temp = target;
+		}
+		if (segs[i].hold) {
+			Reflow_AddPiece(ms, temp, 0, merge);
+			ms += segs[i].hold * 1000;
+			merge = 1;
+		}
+	}
+	profileduration = ms;
+	profileendtemp = temp;
+}
+
+// Compiles a table of setpoints 10s apart straight into pieces, one per step
+// before merging, so the built-in profiles run exactly as tabulated
+static void Reflow_CompileTable(const uint16_t* temps) {
+	uint32_t numpoints = 0;
+
+	numpieces = 0;
+	cursor = 0;
+
+	while (numpoints < NUMPROFILETEMPS && temps[numpoints] != 0 && temps[numpoints] <= SETPOINT_MAX) {
+		numpoints++;
+	}
+	for (uint32_t i = 0; i + 1 < numpoints; i++) {
+		int32_t delta = (temps[i + 1] - temps[i]) * PROFILE_TEMP_SCALE;
+		Reflow_AddPiece(i * PROFILE_STEP_SECS * 1000, temps[i] * PROFILE_TEMP_SCALE,
+				(int32_t)(((int64_t)delta << 16) / (PROFILE_STEP_SECS * 1000)), 1);
+	}
+	profileduration = numpoints ? (numpoints - 1) * PROFILE_STEP_SECS * 1000 : 0;
+	profileendtemp = numpoints ? temps[numpoints - 1] * PROFILE_TEMP_SCALE : 0;
+}
+
+// Converts a table of setpoints 10s apart into segments, the table ends at its
+// first zero setpoint. Returns the number of segments or -1 if they don't fit.
+static int32_t Reflow_TableToSegments(const uint16_t* temps, ProfileSegment_t* segs, uint32_t maxsegs) {
+	uint32_t numpoints = 0;
+	uint32_t num = 0;
+
+	while (numpoints < NUMPROFILETEMPS && temps[numpoints] != 0 && temps[numpoints] <= SETPOINT_MAX) {
+		numpoints++;
+	}
+	if (numpoints == 0) {
+		return 0;
+	}
+
+	segs[num].target = temps[0];
+	segs[num].rate = 0;
+	segs[num].hold = 0;
+	num++;
+
+	for (uint32_t i = 0; i + 1 < numpoints; ) {
+		int32_t delta = temps[i + 1] - temps[i];
+		uint32_t j = i + 1;
+		while (j + 1 < numpoints && temps[j + 1] - temps[j] == delta) {
+			j++;
+		}
+		if (delta == 0) {
+			uint32_t hold = (j - i) * PROFILE_STEP_SECS;
+			while (hold) {
+				if (segs[num - 1].hold == PROFILE_MAX_HOLD) {
+					if (num == maxsegs) return -1;
+					segs[num].target = temps[i];
+					segs[num].rate = 0;
+					segs[num].hold = 0;
+					num++;
+				}
+				uint32_t add = PROFILE_MAX_HOLD - segs[num - 1].hold;
+				if (add > hold) add = hold;
+				segs[num - 1].hold += add;
+				hold -= add;
+			}
+		} else {
+			// A whole degree per step is 0.1C/s, a steeper step than the largest
+			// rate can't be kept on the 10s grid so the table doesn't fit
+			uint32_t rate = (delta < 0 ? -delta : delta) * PROFILE_RATE_SCALE / PROFILE_STEP_SECS;
+			if (num == maxsegs || rate > 255) return -1;
+			segs[num].target = temps[j];
+			segs[num].rate = rate;
+			segs[num].hold = 0;
+			num++;
+		}
+		i = j;
+	}
+	return num;
+}
+
+static uint8_t* Reflow_FindRecord(int slot) {
+	uint8_t* rec = store + 2;
+	while (slot--) {
+		rec += 1 + rec[0] * PROFILE_SEGMENT_BYTES;
+	}
+	return rec;
+}
+
+static uint32_t Reflow_GetStoreUsed(void) {
+	return Reflow_FindRecord(PROFILE_NUM_CUSTOM) - store;
+}
+
+static void Reflow_SetDirty(uint32_t from, uint32_t to) {
+	if (from < dirtyfrom) dirtyfrom = from;
+	if (to > dirtyto) dirtyto = to;
+}
+
+static uint32_t Reflow_UnpackSegments(const uint8_t* rec, ProfileSegment_t* segs) {
+	uint32_t num = rec[0];
+	rec++;
+	for (uint32_t i = 0; i < num; i++, rec += PROFILE_SEGMENT_BYTES) {
+		segs[i].target = rec[0] | ((rec[1] & 0x80) << 1);
+		segs[i].hold = rec[1] & PROFILE_MAX_HOLD;
+		segs[i].rate = rec[2];
+	}
+	return num;
+}
+
+static uint32_t Reflow_PackSegments(uint8_t* rec, const ProfileSegment_t* segs, uint32_t num) {
+	*rec++ = num;
+	for (uint32_t i = 0; i < num; i++, rec += PROFILE_SEGMENT_BYTES) {
+		rec[0] = (uint8_t)segs[i].target;
+		rec[1] = ((segs[i].target >> 1) & 0x80) | segs[i].hold;
+		rec[2] = segs[i].rate;
+	}
+	return 1 + num * PROFILE_SEGMENT_BYTES;
+}
+
+static uint32_t Reflow_DecodeSegments(int slot, ProfileSegment_t* segs) {
+	return Reflow_UnpackSegments(Reflow_FindRecord(slot), segs);
+}
+
+// Replaces the segments of a custom profile, returns -1 if they don't fit
+static int32_t Reflow_EncodeSegments(int slot, const ProfileSegment_t* segs, uint32_t num) {
+	if (num > PROFILE_MAX_SEGMENTS || Reflow_CountPieces(segs, num) > MAX_PIECES) {
+		return -1;
+	}
+	for (uint32_t i = 0; i < num; i++) {
+		if (segs[i].target > SETPOINT_MAX || segs[i].hold > PROFILE_MAX_HOLD) {
+			return -1;
+		}
+	}
+
+	uint8_t* rec = Reflow_FindRecord(slot);
+	uint32_t oldlen = 1 + rec[0] * PROFILE_SEGMENT_BYTES;
+	uint32_t newlen = 1 + num * PROFILE_SEGMENT_BYTES;
+	uint32_t used = Reflow_GetStoreUsed();
+	if (used - oldlen + newlen > STORE_LEN) {
+		return -1;
+	}
+
+	// Move the records that follow
+	uint32_t tail = used - (rec - store) - oldlen;
+	memmove(rec + newlen, rec + oldlen, tail);
+	if (newlen < oldlen) {
+		memset(store + used - oldlen + newlen, 0xff, oldlen - newlen);
+	}
+	Reflow_PackSegments(rec, segs, num);
+	Reflow_SetDirty(rec - store, newlen > oldlen ? used - oldlen + newlen : used);
+	return 0;
+}
+
+static void Reflow_CompileProfile(void) {
+	ProfileSegment_t segs[PROFILE_MAX_SEGMENTS];
+	int slot = Reflow_GetCustomSlot();
+
+	compiledidx = profileidx;
+	if (slot < 0) {
+		Reflow_CompileTable(profiles[profileidx]->temperatures);
+	} else {
+		Reflow_CompileSegments(segs, Reflow_DecodeSegments(slot, segs));
+	}
+}
+
+// Total run time of the selected profile
+uint32_t Reflow_GetProfileDuration(void) {
+	return profileduration;
+}
+
+static const ProfilePiece_t* Reflow_FindPiece(uint32_t ms) {
+	if (cursor >= numpieces) {
+		cursor = 0;
+	}
+	while (cursor > 0 && ms < pieces[cursor].startms) {
+		cursor--;
+	}
+	while (cursor + 1 < numpieces && ms >= pieces[cursor + 1].startms) {
+		cursor++;
+	}
+	return &pieces[cursor];
+}
+
+// Setpoint at any point in time in 1/PROFILE_TEMP_SCALE C, the last setpoint is held
+// after the end of the profile
+int32_t Reflow_GetProfileSetpoint(uint32_t ms) {
+	if (numpieces == 0 || ms >= profileduration) {
+		return profileendtemp;
+	}
+	const ProfilePiece_t* piece = Reflow_FindPiece(ms);
+	return piece->starttemp + (int32_t)(((int64_t)piece->slope * (ms - piece->startms)) >> 16);
+}
+
+// Ramp rate in 1/PROFILE_TEMP_SCALE C per second, 0 outside of the profile
+int32_t Reflow_GetProfileSlope(uint32_t ms) {
+	if (numpieces == 0 || ms >= profileduration) {
+		return 0;
+	}
+	return (int32_t)(((int64_t)Reflow_FindPiece(ms)->slope * 1000) >> 16);
+}
+
 static void ByteswapTempProfile(uint16_t* buf) {
 	for (int i = 0; i < NUMPROFILETEMPS; i++) {
 		uint16_t word = buf[i];
@@ -95,12 +398,73 @@ static void ByteswapTempProfile(uint16_t* buf) {
 	}
 }
 
+// Writes the changed part of the store, EEPROM_Write takes care of the page boundaries
+static int32_t Reflow_WriteStore(void) {
+	int32_t retval = 0;
+	if (dirtyfrom < STORE_AREA1_LEN) {
+		uint32_t to = dirtyto < STORE_AREA1_LEN ? dirtyto : STORE_AREA1_LEN;
+		retval = EEPROM_Write(STORE_AREA1 + dirtyfrom, store + dirtyfrom, to - dirtyfrom);
+		dirtyfrom = to;
+	}
+	if (!retval && dirtyfrom < dirtyto) {
+		retval = EEPROM_Write(STORE_AREA2 + dirtyfrom - STORE_AREA1_LEN, store + dirtyfrom, dirtyto - dirtyfrom);
+	}
+	if (!retval) {
+		dirtyfrom = STORE_LEN;
+		dirtyto = 0;
+	}
+	return retval;
+}
+
+static void Reflow_ClearStore(void) {
+	memset(store, 0xff, sizeof(store));
+	store[0] = STORE_MAGIC0;
+	store[1] = STORE_MAGIC1;
+	memset(store + 2, 0, PROFILE_NUM_CUSTOM);
+	Reflow_SetDirty(0, STORE_LEN);
+}
+
+// Converts the two tables of older firmware (and the original one) to segments
+static void Reflow_MigrateLegacyProfiles(void) {
+	static const uint8_t legacyaddr[] = { LEGACY_PROFILE1, LEGACY_PROFILE2 };
+	uint16_t temps[NUMPROFILETEMPS];
+	ProfileSegment_t segs[PROFILE_MAX_SEGMENTS];
+
+	Reflow_ClearStore();
+	for (int i = 0; i < sizeof(legacyaddr); i++) {
+		EEPROM_Read((uint8_t*)temps, legacyaddr[i], sizeof(temps));
+		ByteswapTempProfile(temps);
+		int32_t num = Reflow_TableToSegments(temps, segs, PROFILE_MAX_SEGMENTS);
+		if (num < 0 || Reflow_EncodeSegments(i, segs, num)) {
+			printf("\nCustom profile %d doesn't fit in segment format, cleared", i + 1);
+		}
+	}
+	printf("\nConverted custom profiles to segment format, %u bytes", (unsigned)Reflow_GetStoreUsed());
+	Reflow_WriteStore();
+}
+
 void Reflow_LoadCustomProfiles(void) {
-	EEPROM_Read((uint8_t*)ee1.temperatures, 2, 96);
-	ByteswapTempProfile(ee1.temperatures);
+	EEPROM_Read(store, STORE_AREA1, STORE_AREA1_LEN);
+	EEPROM_Read(store + STORE_AREA1_LEN, STORE_AREA2, STORE_AREA2_LEN);
 
-	EEPROM_Read((uint8_t*)ee2.temperatures, 128 + 2, 96);
-	ByteswapTempProfile(ee2.temperatures);
+	if (store[0] != STORE_MAGIC0 || store[1] != STORE_MAGIC1) {
+		Reflow_MigrateLegacyProfiles();
+	} else {
+		// Walk the records to make sure they're all within the store
+		uint32_t pos = 2;
+		int i;
+		for (i = 0; i < PROFILE_NUM_CUSTOM; i++) {
+			if (pos >= STORE_LEN || store[pos] > PROFILE_MAX_SEGMENTS) break;
+			pos += 1 + store[pos] * PROFILE_SEGMENT_BYTES;
+		}
+		if (i < PROFILE_NUM_CUSTOM || pos > STORE_LEN) {
+			printf("\nCustom profile store corrupt, cleared");
+			Reflow_ClearStore();
+			Reflow_WriteStore();
+		}
+	}
+	editslot = -1;
+	Reflow_CompileProfile();
 }
 
 void Reflow_ValidateNV(void) {
@@ -120,9 +484,36 @@ void Reflow_ValidateNV(void) {
 		printf("Resetting bake setpoint to default.");
 	}
 
+	if (NV_GetConfig(TELEMETRY_INTERVAL) == 255 || NV_GetConfig(TELEMETRY_INTERVAL) == 0) {
+		// Default 250ms, the rate the log has always had
+		NV_SetConfig(TELEMETRY_INTERVAL, 250 / TELEMETRY_INTERVAL_UNIT);
+	}
+
+	if (NV_GetConfig(REFLOW_FF_GAIN) == 255) {
+		// A stock oven ramps ~2.5C/s from cold at full power, so ~100 counts per C/s
+		NV_SetConfig(REFLOW_FF_GAIN, 100);
+	}
+
+	if (NV_GetConfig(REFLOW_MPC) > 1) {
+		NV_SetConfig(REFLOW_MPC, 0);
+	}
+
+	// Anything outside the setup menu limits, a zero gain or time constant breaks the model
+	if (NV_GetConfig(MPC_GAIN) < 10 || NV_GetConfig(MPC_GAIN) == 255 ||
+	    NV_GetConfig(MPC_TAU) < 1 || NV_GetConfig(MPC_TAU) == 255 || NV_GetConfig(MPC_DEADTIME) > 250) {
+		// Ballpark for a stock oven until autotune has identified the real one
+		NV_SetConfig(MPC_GAIN, 260 / 2);
+		NV_SetConfig(MPC_TAU, 210 / 2);
+		NV_SetConfig(MPC_DEADTIME, 80);
+	}
+
 	Reflow_SelectProfileIdx(NV_GetConfig(REFLOW_PROFILE));
 }
 
+int Reflow_GetNumProfiles(void) {
+	return NUMPROFILES;
+}
+
 int Reflow_GetProfileIdx(void) {
 	return profileidx;
 }
@@ -136,75 +527,141 @@ int Reflow_SelectProfileIdx(int idx) {
 		profileidx = idx;
 	}
 	NV_SetConfig(REFLOW_PROFILE, profileidx);
+	if (profileidx != compiledidx) {
+		Reflow_CompileProfile();
+	}
 	return profileidx;
 }
 
 int Reflow_SelectEEProfileIdx(int idx) {
-	if (idx == 1) {
-		profileidx = (NUMPROFILES - 2);
-	} else if (idx == 2) {
-		profileidx = (NUMPROFILES - 1);
+	if (idx >= 1 && idx <= PROFILE_NUM_CUSTOM) {
+		profileidx = NUMBUILTINPROFILES + idx - 1;
+	}
+	if (profileidx != compiledidx) {
+		Reflow_CompileProfile();
 	}
 	return profileidx;
 }
 
 int Reflow_GetEEProfileIdx(void) {
-	if (profileidx == (NUMPROFILES - 2)) {
-		return 1;
-	} else 	if (profileidx == (NUMPROFILES - 1)) {
-		return 2;
-	} else {
-		return 0;
-	}
+	return Reflow_GetCustomSlot() + 1;
 }
 
 int Reflow_SaveEEProfile(void) {
-	int retval = 0;
-	uint8_t offset;
-	uint16_t* tempptr;
-	if (profileidx == (NUMPROFILES - 2)) {
-		offset = 0;
-		tempptr = ee1.temperatures;
-	} else if (profileidx == (NUMPROFILES - 1)) {
-		offset = 128;
-		tempptr = ee2.temperatures;
-	} else {
+	if (Reflow_GetCustomSlot() < 0) {
 		return -1;
 	}
-	offset += 2; // Skip "magic"
-	ByteswapTempProfile(tempptr);
+	return Reflow_WriteStore();
+}
 
-	// Store profile
-	retval = EEPROM_Write(offset, (uint8_t*)tempptr, 96);
-	ByteswapTempProfile(tempptr);
-	return retval;
+// Fills buf with the profile as a record, returns its length, -1 if there's no such
+// profile or -2 if it's a built-in table that doesn't fit in segments
+int32_t Reflow_GetProfileRecord(int profile, uint8_t* buf) {
+	if (profile < 0 || profile >= NUMPROFILES) {
+		return -1;
+	}
+	if (profile >= NUMBUILTINPROFILES) {
+		const uint8_t* rec = Reflow_FindRecord(profile - NUMBUILTINPROFILES);
+		uint32_t len = 1 + rec[0] * PROFILE_SEGMENT_BYTES;
+		memcpy(buf, rec, len);
+		return len;
+	}
+	ProfileSegment_t segs[PROFILE_MAX_SEGMENTS];
+	int32_t num = Reflow_TableToSegments(profiles[profile]->temperatures, segs, PROFILE_MAX_SEGMENTS);
+	if (num < 0) {
+		return -2;
+	}
+	return Reflow_PackSegments(buf, segs, num);
+}
+
+// Replaces a custom profile with a record and saves it, returns -1 if it isn't a custom
+// profile, -2 if the record is malformed, -3 if it doesn't fit and -4 on EEPROM errors
+int32_t Reflow_PutProfileRecord(int profile, const uint8_t* buf, uint32_t len) {
+	ProfileSegment_t segs[PROFILE_MAX_SEGMENTS];
+
+	if (profile < NUMBUILTINPROFILES || profile >= NUMPROFILES) {
+		return -1;
+	}
+	if (len == 0 || buf[0] > PROFILE_MAX_SEGMENTS || len != 1 + buf[0] * PROFILE_SEGMENT_BYTES) {
+		return -2;
+	}
+	uint32_t num = Reflow_UnpackSegments(buf, segs);
+	for (uint32_t i = 0; i < num; i++) {
+		if (segs[i].target == 0 || segs[i].target > SETPOINT_MAX) {
+			return -2;
+		}
+	}
+	if (Reflow_EncodeSegments(profile - NUMBUILTINPROFILES, segs, num)) {
+		return -3;
+	}
+	editslot = -1;
+	if (profile == profileidx) {
+		Reflow_CompileProfile();
+	}
+	return Reflow_WriteStore() ? -4 : 0;
 }
 
 void Reflow_ListProfiles(void) {
+	int current = profileidx;
 	for (int i = 0; i < NUMPROFILES; i++) {
-		printf("%d: %s\n", i, profiles[i]->name);
+		profileidx = i;
+		printf("%d: %s\n", i, Reflow_GetProfileName());
 	}
+	profileidx = current;
+	printf("Custom profiles use %u of %u bytes\n", (unsigned)Reflow_GetStoreUsed(), STORE_LEN);
 }
 
 const char* Reflow_GetProfileName(void) {
-	return profiles[profileidx]->name;
+	int slot = Reflow_GetCustomSlot();
+	if (slot < 0) {
+		return profiles[profileidx]->name;
+	}
+	snprintf(customname, sizeof(customname), "CUSTOM #%d", slot + 1);
+	return customname;
 }
 
 uint16_t Reflow_GetSetpointAtIdx(uint8_t idx) {
 	if (idx > (NUMPROFILETEMPS - 1)) {
 		return 0;
 	}
-	return profiles[profileidx]->temperatures[idx];
+	int slot = Reflow_GetCustomSlot();
+	if (slot < 0) {
+		return profiles[profileidx]->temperatures[idx];
+	} else if (slot == editslot) {
+		return edittemps[idx];
+	}
+
+	// Sample custom profiles on the 10s grid, zero past the end like the tables
+	uint32_t ms = idx * PROFILE_STEP_SECS * 1000;
+	if (profileendtemp == 0 || ms > profileduration) {
+		return 0;
+	}
+	return (Reflow_GetProfileSetpoint(ms) + PROFILE_TEMP_SCALE / 2) >> PROFILE_TEMP_FRACBITS;
 }
 
 void Reflow_SetSetpointAtIdx(uint8_t idx, uint16_t value) {
 	if (idx > (NUMPROFILETEMPS - 1)) { return; }
 	if (value > SETPOINT_MAX) { return; }
 
-	uint16_t* temp = (uint16_t*) &profiles[profileidx]->temperatures[idx];
-	if (temp >= (uint16_t*)0x40000000) {
-		*temp = value; // If RAM-based
+	int slot = Reflow_GetCustomSlot();
+	if (slot < 0) { return; }
+
+	if (slot != editslot) {
+		for (int i = 0; i < NUMPROFILETEMPS; i++) {
+			edittemps[i] = Reflow_GetSetpointAtIdx(i);
+		}
+		editslot = slot;
+	}
+
+	uint16_t old = edittemps[idx];
+	ProfileSegment_t segs[PROFILE_MAX_SEGMENTS];
+	edittemps[idx] = value;
+	int32_t num = Reflow_TableToSegments(edittemps, segs, PROFILE_MAX_SEGMENTS);
+	if (num < 0 || Reflow_EncodeSegments(slot, segs, num)) {
+		edittemps[idx] = old; // Out of EEPROM space
+		return;
 	}
+	Reflow_CompileProfile();
 }
 
 void Reflow_PlotProfile(int highlight) {
@@ -213,7 +670,7 @@ void Reflow_PlotProfile(int highlight) {
 	// No need to plot first value as it is obscured by Y-axis
 	for(int x = 1; x < NUMPROFILETEMPS; x++) {
 		int realx = (x << 1) + XAXIS;
-		int y = profiles[profileidx]->temperatures[x] / 5;
+		int y = Reflow_GetSetpointAtIdx(x) / 5;
 		y = YAXIS - y;
 		LCD_SetPixel(realx, y);
 
@@ -227,20 +684,39 @@ void Reflow_PlotProfile(int highlight) {
 }
 
 void Reflow_DumpProfile(int profile) {
-	if (profile > NUMPROFILES) {
+	if (profile < 0 || profile >= NUMPROFILES) {
 		printf("\nNo profile with id: %d\n", profile);
 		return;
 	}
 
 	int current = profileidx;
 	profileidx = profile;
-
-	for (int i = 0; i < NUMPROFILETEMPS; i++) {
-		printf("%4d,", Reflow_GetSetpointAtIdx(i));
-		if (i == 15 || i == 31) {
-			printf("\n ");
+	printf("\nDumping profile %d: %s\n ", profile, Reflow_GetProfileName());
+
+	int slot = Reflow_GetCustomSlot();
+	if (slot >= 0) {
+		ProfileSegment_t segs[PROFILE_MAX_SEGMENTS];
+		uint32_t num = Reflow_DecodeSegments(slot, segs);
+		for (uint32_t i = 0; i < num; i++) {
+			printf("%3u`", segs[i].target);
+			if (i && segs[i].target != segs[i - 1].target) {
+				if (segs[i].rate) {
+					printf(" at %u.%uC/s", segs[i].rate / PROFILE_RATE_SCALE, segs[i].rate % PROFILE_RATE_SCALE);
+				} else {
+					printf(" step");
+				}
+			}
+			printf(", hold %us\n ", segs[i].hold);
+		}
+		printf("%u segments, %u bytes\n", (unsigned)num, (unsigned)(1 + num * PROFILE_SEGMENT_BYTES));
+	} else {
+		for (int i = 0; i < NUMPROFILETEMPS; i++) {
+			printf("%4d,", Reflow_GetSetpointAtIdx(i));
+			if (i == 15 || i == 31) {
+				printf("\n ");
+			}
 		}
+		printf("\n");
 	}
-	printf("\n");
 	profileidx = current;
 }
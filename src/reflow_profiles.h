@@ -4,6 +4,25 @@
 // Number of temperature settings in a reflow profile
 #define NUMPROFILETEMPS (48)
 
+// Seconds between the temperature settings of a profile table
+#define PROFILE_STEP_SECS (10)
+
+// Profile setpoints are evaluated in 1/PROFILE_TEMP_SCALE degrees C
+#define PROFILE_TEMP_SCALE (16)
+#define PROFILE_TEMP_FRACBITS (4)
+
+// Number of custom profiles kept in EEPROM
+#define PROFILE_NUM_CUSTOM (8)
+
+// Segment ramp rates are in 1/PROFILE_RATE_SCALE C/s
+#define PROFILE_RATE_SCALE (10)
+#define PROFILE_MAX_HOLD (127)
+#define PROFILE_MAX_SEGMENTS (48)
+
+// A profile record is a segment count followed by the packed segments, as stored in EEPROM
+#define PROFILE_SEGMENT_BYTES (3)
+#define PROFILE_RECORD_MAX (1 + PROFILE_MAX_SEGMENTS * PROFILE_SEGMENT_BYTES)
+
 #define YAXIS (57)
 #define XAXIS (12)
 
@@ -12,25 +31,33 @@ typedef struct {
 	const uint16_t temperatures[NUMPROFILETEMPS];
 } profile;
 
+// Ramps to target at rate (a step if 0), then holds it for hold seconds
 typedef struct {
-	const char* name;
-	uint16_t temperatures[NUMPROFILETEMPS];
-} ramprofile;
+	uint16_t target;
+	uint8_t rate;
+	uint8_t hold;
+} ProfileSegment_t;
 
 void Reflow_LoadCustomProfiles(void);
 void Reflow_ValidateNV(void);
 void Reflow_PlotProfile(int highlight);
 
+int Reflow_GetNumProfiles(void);
 int Reflow_GetProfileIdx(void);
 int Reflow_SelectProfileIdx(int idx);
 int Reflow_SelectEEProfileIdx(int idx);
 
 int Reflow_GetEEProfileIdx(void);
 int Reflow_SaveEEProfile(void);
+int32_t Reflow_GetProfileRecord(int profile, uint8_t* buf);
+int32_t Reflow_PutProfileRecord(int profile, const uint8_t* buf, uint32_t len);
 void Reflow_ListProfiles(void);
 const char* Reflow_GetProfileName(void);
 uint16_t Reflow_GetSetpointAtIdx(uint8_t idx);
 void Reflow_SetSetpointAtIdx(uint8_t idx, uint16_t value);
+uint32_t Reflow_GetProfileDuration(void);
+int32_t Reflow_GetProfileSetpoint(uint32_t ms);
+int32_t Reflow_GetProfileSlope(uint32_t ms);
 void Reflow_DumpProfile(int profile);
 
 #endif /* REFLOW_PROFILES_H */
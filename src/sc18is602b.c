@@ -17,15 +17,162 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "LPC214x.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include "i2c.h"
+#include "sched.h"
 #include "sc18is602b.h"
 
 #define SCADDR (0x28<<1)
-static uint8_t scaddr;
+static uint8_t scaddr = 0;
+
+// Give up on a transfer the bridge still hasn't finished after this long
+#define SC18IS602B_TIMEOUT_MS (5)
+
+// SPI transfers shorter than this are over before a read can follow the write
+// on the I2C bus, so the read is queued right behind it (4 bytes at 1843kHz is 17us)
+#define SC18IS602B_PIPELINE_US (40)
+
+// Don't poll a busy bridge more often than this
+#define SC18IS602B_MIN_POLL_US (100)
+
+// Uncomment to sense completion on the bridge INT output (active low, port 0)
+// instead of polling with reads that are NACKed while it's busy
+//#define SC18IS602B_INTPIN (1 << 15)
+
+// SPI clock from the 7.3728MHz bridge crystal
+static const uint32_t spiclkhz[] = { 1843200, 460800, 115200, 57600 };
+static uint32_t spibyteticks;
+
+/*
+ * Transfers started with SC18IS602B_SPI_Start are queued and carried out one
+ * at a time straight from the I2C completion callbacks. Writing the slave
+ * select mask and data starts the SPI transfer, the bridge doesn't acknowledge
+ * its address until that's done, then the data clocked in is read back. The
+ * first read attempt is timed from the SPI clock and length, after that it's
+ * retried at the same interval until SC18IS602B_TIMEOUT_MS has passed.
+ */
+
+typedef enum {
+	SC_IDLE = 0,
+	SC_WRITING, // Read may be queued behind the write already
+	SC_WAITING, // Bridge busy with the SPI transfer
+	SC_READING,
+} SCPhase_t;
+
+static SPIxfer_t* schead = NULL;
+static SPIxfer_t* sctail = NULL;
+static SCPhase_t scphase = SC_IDLE;
+static uint8_t screadqueued = 0;
+static int32_t scwriteresult;
+static uint32_t scstart; // SPI transfer started
+static uint32_t scpollticks;
+static I2CXfer_t i2cwrite;
+static I2CXfer_t i2cread;
+#ifdef SC18IS602B_INTPIN
+static uint8_t clearintcmd = 0xf1;
+static I2CXfer_t i2cclearint;
+#endif
+
+static void SC18IS602B_Begin(void);
+
+static void SC18IS602B_Finish(int32_t result) {
+	SPIxfer_t* item = schead;
+	schead = item->next;
+	if (schead == NULL) {
+		sctail = NULL;
+	}
+	item->next = NULL;
+	scphase = SC_IDLE;
+#ifdef SC18IS602B_INTPIN
+	i2cclearint = (I2CXfer_t){ .slaveaddr = scaddr, .buf = &clearintcmd, .len = 1, .done = NULL };
+	I2C_Submit(&i2cclearint);
+#endif
+	if (schead) {
+		SC18IS602B_Begin();
+	}
+	item->done(item, result);
+}
+
+static void SC18IS602B_ReadDone(I2CXfer_t* xfer) {
+	screadqueued = 0;
+	if (scwriteresult) {
+		SC18IS602B_Finish(scwriteresult);
+	} else if (xfer->result == 0) {
+		SC18IS602B_Finish(0);
+	} else if ((Sched_GetTick() - scstart) >= TICKS_MS(SC18IS602B_TIMEOUT_MS)) {
+		SC18IS602B_Finish(SC18IS602B_TIMEOUT);
+	} else {
+		scphase = SC_WAITING; // Still busy
+		Sched_SetState(SPIBRIDGE_WORK, 1, scpollticks);
+	}
+}
+
+static void SC18IS602B_Read(void) {
+	i2cread = (I2CXfer_t){
+		.slaveaddr = scaddr | 1,
+		.buf = schead->data,
+		.len = schead->len,
+		.done = SC18IS602B_ReadDone,
+	};
+	screadqueued = 1;
+	if (scphase != SC_WRITING) {
+		scphase = SC_READING;
+	}
+	I2C_Submit(&i2cread);
+}
+
+static void SC18IS602B_WriteDone(I2CXfer_t* xfer) {
+	scstart = Sched_GetTick();
+	scwriteresult = xfer->result;
+	if (screadqueued) {
+		scphase = SC_READING; // ReadDone takes care of the rest
+	} else if (scwriteresult) {
+		SC18IS602B_Finish(scwriteresult);
+	} else {
+		scphase = SC_WAITING;
+		Sched_SetState(SPIBRIDGE_WORK, 1, scpollticks);
+	}
+}
+
+static void SC18IS602B_Begin(void) {
+	uint32_t spiticks = schead->len * spibyteticks;
+	scpollticks = spiticks > TICKS_US(SC18IS602B_MIN_POLL_US) ? spiticks : TICKS_US(SC18IS602B_MIN_POLL_US);
+	i2cwrite = (I2CXfer_t){
+		.slaveaddr = scaddr,
+		.buf = (uint8_t*)schead, // ssmask + data
+		.len = schead->len + 1,
+		.done = SC18IS602B_WriteDone,
+	};
+	scphase = SC_WRITING;
+	I2C_Submit(&i2cwrite);
+#ifndef SC18IS602B_INTPIN
+	if (spiticks <= TICKS_US(SC18IS602B_PIPELINE_US)) {
+		SC18IS602B_Read();
+	}
+#endif
+}
+
+// Polls a busy bridge
+static int32_t SC18IS602B_Work(void) {
+	if (scphase != SC_WAITING) {
+		return -1;
+	}
+#ifdef SC18IS602B_INTPIN
+	if (FIO0PIN & SC18IS602B_INTPIN) {
+		if ((Sched_GetTick() - scstart) >= TICKS_MS(SC18IS602B_TIMEOUT_MS)) {
+			SC18IS602B_Finish(SC18IS602B_TIMEOUT);
+			return -1;
+		}
+		return scpollticks;
+	}
+#endif
+	SC18IS602B_Read();
+	return -1;
+}
 
 int32_t SC18IS602B_Init( SPIclk_t clk, SPImode_t mode, SPIorder_t order ) {
 	uint8_t function[2];
@@ -41,6 +188,11 @@ int32_t SC18IS602B_Init( SPIclk_t clk, SPImode_t mode, SPIorder_t order ) {
 		}
 	}
 	if( retval == 0 ) {
+		spibyteticks = (8 * (PCLKFREQ / TIMER_PRESCALER) + spiclkhz[clk] - 1) / spiclkhz[clk];
+		Sched_SetWorkfunc(SPIBRIDGE_WORK, SC18IS602B_Work);
+#ifdef SC18IS602B_INTPIN
+		FIO0DIR &= ~SC18IS602B_INTPIN;
+#endif
 		printf( "- Done (addr 0x%02x)", scaddr>>1);
 	} else {
 		printf( "- No chip found");
@@ -48,18 +200,40 @@ int32_t SC18IS602B_Init( SPIclk_t clk, SPImode_t mode, SPIorder_t order ) {
 	return retval;
 }
 
+// Blocking transfer, only for use before any SC18IS602B_SPI_Start transfers are queued
 int32_t SC18IS602B_SPI_Xfer( SPIxfer_t* item ) {
 	int32_t retval;
-	if( item->len > (sizeof(SPIxfer_t) - 2) ) {
+	if( item->len > sizeof(item->data) ) {
 		printf("\n%s: Invalid length!",__FUNCTION__);
 		return -1;
 	}
 	retval = I2C_Xfer(scaddr, (uint8_t*)item, item->len + 1, 1); // Initialize transfer, ssmask + data
 	if( retval == 0 ) {
-		// TODO: There should be a timeout here
+		uint32_t start = Sched_GetTick();
 		do {
 			retval = I2C_Xfer(scaddr + 1, (uint8_t*)item->data, item->len, 1); // Initialize read transfer, data only
-		} while( retval != 0 ); // Wait for chip to be done with transaction
+		} while( retval != 0 && (Sched_GetTick() - start) < TICKS_MS(SC18IS602B_TIMEOUT_MS) ); // Wait for chip to be done with transaction
+		if( retval != 0 ) {
+			retval = SC18IS602B_TIMEOUT;
+		}
 	}
 	return retval;
 }
+
+// Queues a transfer, done is called from task context once it's over. Returns -1 if
+// there is no bridge or the length is invalid, done is not called in that case.
+int32_t SC18IS602B_SPI_Start( SPIxfer_t* item, SPIDone_t done ) {
+	if( scaddr == 0 || item->len == 0 || item->len > sizeof(item->data) ) {
+		return -1;
+	}
+	item->done = done;
+	item->next = NULL;
+	if( schead ) {
+		sctail->next = item;
+		sctail = item;
+	} else {
+		schead = sctail = item;
+		SC18IS602B_Begin();
+	}
+	return 0;
+}
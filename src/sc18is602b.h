@@ -20,13 +20,24 @@ typedef enum eSPIorder {
 	SPIORDER_LSBFIRST=(1<<5),
 } SPIorder_t;
 
-typedef struct __attribute__ ((__packed__)) {
+#define SC18IS602B_TIMEOUT (-2)
+
+struct SPIxfer;
+
+// Called from task context when an SC18IS602B_SPI_Start transfer is done, result is 0 or negative on error
+typedef void (*SPIDone_t)( struct SPIxfer* item, int32_t result );
+
+typedef struct __attribute__ ((__packed__)) SPIxfer {
 	uint8_t ssmask;
 	uint8_t data[16]; // Max 16 bytes at the moment
 	uint8_t len;
+	// Not sent, only used while queued by SC18IS602B_SPI_Start
+	SPIDone_t done;
+	struct SPIxfer* next;
 } SPIxfer_t;
 
 int32_t SC18IS602B_Init( SPIclk_t clk, SPImode_t mode, SPIorder_t order );
 int32_t SC18IS602B_SPI_Xfer( SPIxfer_t* item );
+int32_t SC18IS602B_SPI_Start( SPIxfer_t* item, SPIDone_t done );
 
 #endif /* SC18IS602B_H_ */
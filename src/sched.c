@@ -20,40 +20,197 @@
 #include "LPC214x.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "sched.h"
+#include "vic.h"
 
 // Not a public struct - therefore it's defined here
 typedef struct SchedItem {
-    uint32_t dueTicks;
+	uint32_t dueTicks; // Absolute deadline in scheduler time
 	SchedCall_t workFunc;
 	uint8_t enabled;
+	uint8_t prio;
+	uint8_t heappos; // Position in the deadline heap of its priority class, or NOT_QUEUED
 } SchedItem_t;
 
-static SchedItem_t tasks[SCHED_NUM_ITEMS];
+#define NOT_QUEUED (0xff)
+
+static SchedItem_t tasks[SCHED_MAX_TASKS];
+static SchedStats_t stats[SCHED_MAX_TASKS];
+
+static const char* tasknames[SCHED_NUM_ITEMS] = {
+	"Sleep", "Buzzer", "Keypad", "SysFanPWM", "Main", "ADC",
+	"OneWire", "SPI_TC", "UI", "Reflow", "SysFanSense", "NV", "Telemetry", "Sensor", "I2C", "SPIBridge"
+};
+
+// One binary min-heap of task numbers per priority class ordered by dueTicks,
+// the next task due in each class is always at the top
+static uint8_t heap[SCHED_NUM_PRIOS][SCHED_MAX_TASKS];
+static uint8_t heapsize[SCHED_NUM_PRIOS];
+
+// Scheduler time base, this is Timer0 ticks plus any fast-forwarded ticks
+static uint32_t schedtime = 0;
+
+// Lock-free single-producer/single-consumer queue from interrupt handlers to Sched_Do.
+// IRQs don't nest on this target so all handlers together count as one producer.
+#define EVQ_SIZE (16) // Must be a power of 2
+typedef struct {
+	uint8_t tasknum;
+	uint32_t events;
+	int32_t future;
+	uint32_t posttick;
+} SchedEvent_t;
+
+static SchedEvent_t evq[EVQ_SIZE];
+static volatile uint8_t evqhead = 0; // Only written by the producer
+static volatile uint8_t evqtail = 0; // Only written by Sched_Do
+static volatile uint32_t evqdropped = 0;
+
+// Event flags delivered to each task, only touched from Sched_Do and the tasks themselves
+static uint32_t taskevents[SCHED_MAX_TASKS];
+
+// Deadlines are compared as signed differences so the 32-bit time base is allowed to wrap
+static inline int IsBefore(uint8_t a, uint8_t b) {
+	int32_t diff = (int32_t)(tasks[a].dueTicks - tasks[b].dueTicks);
+	// Equal deadlines are dispatched in task order, just like the old linear scan
+	return (diff < 0) || (diff == 0 && a < b);
+}
+
+static inline void HeapPlace(uint8_t* h, uint8_t pos, uint8_t tasknum) {
+	h[pos] = tasknum;
+	tasks[tasknum].heappos = pos;
+}
+
+static void HeapSiftUp(uint8_t* h, uint8_t pos) {
+	uint8_t tasknum = h[pos];
+	while (pos > 0) {
+		uint8_t parent = (pos - 1) >> 1;
+		if (!IsBefore(tasknum, h[parent])) break;
+		HeapPlace(h, pos, h[parent]);
+		pos = parent;
+	}
+	HeapPlace(h, pos, tasknum);
+}
+
+static void HeapSiftDown(uint8_t* h, uint8_t size, uint8_t pos) {
+	uint8_t tasknum = h[pos];
+	while (1) {
+		uint8_t child = (pos << 1) + 1;
+		if (child >= size) break;
+		if ((child + 1) < size && IsBefore(h[child + 1], h[child])) child++;
+		if (!IsBefore(h[child], tasknum)) break;
+		HeapPlace(h, pos, h[child]);
+		pos = child;
+	}
+	HeapPlace(h, pos, tasknum);
+}
+
+static void HeapRemove(uint8_t tasknum) {
+	uint8_t pos = tasks[tasknum].heappos;
+	if (pos == NOT_QUEUED) return;
+	uint8_t prio = tasks[tasknum].prio;
+	uint8_t* h = heap[prio];
+	tasks[tasknum].heappos = NOT_QUEUED;
+	uint8_t size = --heapsize[prio];
+	if (pos != size) { // Move the last item into the hole and restore heap order
+		HeapPlace(h, pos, h[size]);
+		if (pos > 0 && IsBefore(h[pos], h[(pos - 1) >> 1])) {
+			HeapSiftUp(h, pos);
+		} else {
+			HeapSiftDown(h, size, pos);
+		}
+	}
+}
+
+// Insert a task with a new deadline, or move it if it's already queued
+static void HeapArm(uint8_t tasknum, uint32_t due) {
+	HeapRemove(tasknum);
+	uint8_t prio = tasks[tasknum].prio;
+	tasks[tasknum].dueTicks = due;
+	HeapPlace(heap[prio], heapsize[prio], tasknum);
+	HeapSiftUp(heap[prio], heapsize[prio]++);
+}
+
+// Is the first task in this priority class due at the given time?
+static inline int HeapTopIsDue(uint8_t prio, uint32_t now) {
+	return heapsize[prio] && (int32_t)(tasks[heap[prio][0]].dueTicks - now) <= 0;
+}
+
+// Only purpose of the MR0 match interrupt is to bring the core out of idle mode
+static void __attribute__ ((interrupt ("IRQ"))) Sched_IRQHandler( void ) {
+	T0MCR = 0x00; // One-shot, Sched_Sleep re-arms it
+	T0IR = 0x01; // ACK MR0 match
+	VICVectAddr = 0; // ACK irq
+}
 
 void Sched_Init(void) {
+	for (uint8_t lp = 0; lp < SCHED_MAX_TASKS; lp++) {
+		tasks[lp].heappos = NOT_QUEUED;
+		tasks[lp].prio = SCHED_PRIO_NORMAL;
+	}
 	T0CTCR = 0; // Normal timer mode
 	T0PR = TIMER_PRESCALER - 1; // Prescaler divisor, timer now ticks in usecs/8 (-1.25% off as clk is 55.296MHz)
 	T0TCR = 0x01; // Enable timer
-	T0MCR = 0x01; // Interrupt on MCR0 match
+	T0MCR = 0x00; // MR0 match interrupt is only enabled while sleeping
+
+	VIC_RegisterHandler(VIC_TIMER0, Sched_IRQHandler);
+	VIC_EnableHandler(VIC_TIMER0);
 }
 
 uint32_t Sched_GetTick(void) {
 	return T0TC;
 }
 
-// The enable is atomic but the dueTicks are not, so only call this with 0 or 2 as enable parameter
-// (2 will force scheduling as soon as possible without relying on dueTicks to be correct)
+// Timer0 wraps after about 9 minutes, the upper 32 bits are extended in software
+// whenever the counter is read. Sched_Do reads it on every pass which is far more
+// often than once per wrap. Not safe to call from interrupt context.
+uint64_t Sched_GetTick64(void) {
+	static uint32_t tickhigh = 0;
+	static uint32_t lastlow = 0;
+	uint32_t save = VIC_DisableIRQ();
+	uint32_t low = T0TC;
+	if (low < lastlow) {
+		tickhigh++;
+	}
+	lastlow = low;
+	uint64_t retval = ((uint64_t)tickhigh << 32) | low;
+	VIC_RestoreIRQ(save);
+	return retval;
+}
+
+// PCLKFREQ / 1000 is an integer so these conversions are exact
+uint64_t Sched_TicksToUs(uint64_t ticks) {
+	return (ticks * TIMER_PRESCALER * 1000) / (PCLKFREQ / 1000);
+}
+
+uint64_t Sched_TicksToMs(uint64_t ticks) {
+	return (ticks * TIMER_PRESCALER) / (PCLKFREQ / 1000);
+}
+
+uint64_t Sched_GetUs(void) {
+	return Sched_TicksToUs(Sched_GetTick64());
+}
+
+uint64_t Sched_GetMs(void) {
+	return Sched_TicksToMs(Sched_GetTick64());
+}
+
+// Not safe to call from interrupt context as the deadline heap is updated here,
+// use Sched_PostFromISR instead.
+// Enable 1 schedules the task future ticks from the last scheduler pass,
+// 2 will force scheduling as soon as possible (future is ignored)
 void Sched_SetState(Task_t tasknum, uint8_t enable, int32_t future) {
-	if (enable == 1) {
-		tasks[tasknum].dueTicks = future;
+	if (enable == 0) {
+		HeapRemove(tasknum);
+	} else {
+		HeapArm(tasknum, schedtime + ((enable == 1) ? future : 0));
 	}
 	tasks[tasknum].enabled = enable;
 }
 
 uint8_t Sched_IsOverride(void) {
 	uint8_t retval = 0; // No override by default
-	for (uint8_t lp = 0; lp < SCHED_NUM_ITEMS; lp++) {
+	for (uint8_t lp = 0; lp < SCHED_MAX_TASKS; lp++) {
 		if (tasks[lp].enabled == 2) {
 			retval = 1;
 			//if(SelectiveDebugIsEnabled(SD_SCHED_OVERRIDE)) wjprintf_P(PSTR("\nTask 0x%x overrides sleep!"), lp);
@@ -66,42 +223,209 @@ void Sched_SetWorkfunc(Task_t tasknum, SchedCall_t func) {
 	tasks[tasknum].workFunc = func;
 }
 
+// Wake up a task from interrupt context, optionally also setting event flags for it.
+// Future is relative to the time of the post, 0 schedules it as soon as possible.
+// Nothing is touched but the queue, Sched_Do applies it on the next pass.
+void Sched_PostFromISR(Task_t tasknum, uint32_t events, int32_t future) {
+	uint8_t head = evqhead;
+	uint8_t newhead = (head + 1) & (EVQ_SIZE - 1);
+	if (newhead == evqtail) {
+		evqdropped++; // Full
+		return;
+	}
+	evq[head].tasknum = tasknum;
+	evq[head].events = events;
+	evq[head].future = future;
+	evq[head].posttick = Sched_GetTick();
+	evqhead = newhead; // Publish the entry only after it's complete
+}
+
+// Returns and clears the event flags posted to a task
+uint32_t Sched_GetEvents(Task_t tasknum) {
+	uint32_t retval = taskevents[tasknum];
+	taskevents[tasknum] = 0;
+	return retval;
+}
+
+static void Sched_DrainEvents(uint32_t curTick) {
+	uint8_t tail = evqtail;
+	while (tail != evqhead) {
+		SchedEvent_t* ev = &evq[tail];
+		uint8_t tasknum = ev->tasknum;
+		taskevents[tasknum] |= ev->events;
+
+		// Deadline relative to when it was posted, a wake-up never postpones an earlier deadline
+		uint32_t due = schedtime - (curTick - ev->posttick) + ((ev->future > 0) ? ev->future : 0);
+		if (tasks[tasknum].heappos == NOT_QUEUED || (int32_t)(due - tasks[tasknum].dueTicks) < 0) {
+			HeapArm(tasknum, due);
+		}
+		if (ev->future <= 0) {
+			tasks[tasknum].enabled = 2;
+		} else if (tasks[tasknum].enabled == 0) {
+			tasks[tasknum].enabled = 1;
+		}
+
+		tail = (tail + 1) & (EVQ_SIZE - 1);
+		evqtail = tail; // Hand the slot back to the producer
+	}
+}
+
+void Sched_SetPriority(Task_t tasknum, SchedPrio_t prio) {
+	if (prio >= SCHED_NUM_PRIOS || tasks[tasknum].prio == prio) return;
+	uint8_t queued = (tasks[tasknum].heappos != NOT_QUEUED);
+	HeapRemove(tasknum);
+	tasks[tasknum].prio = prio;
+	if (queued) {
+		HeapArm(tasknum, tasks[tasknum].dueTicks);
+	}
+}
+
 int32_t Sched_Do(uint32_t fastforward) {
 	static uint32_t oldTick = 0;
-	int32_t shortestwait = 0x7fffffff;
-	uint32_t curTick = Sched_GetTick();
+	uint8_t due[SCHED_MAX_TASKS];
+	uint32_t curTick = (uint32_t)Sched_GetTick64(); // Also keeps the 64-bit time base extended
 
 	// How many ticks will we should roll forward (including sleep time)
-	uint32_t numRollFwd = (curTick - oldTick) + fastforward;
+	schedtime += (curTick - oldTick) + fastforward;
 	oldTick = curTick;
 
-	for (uint8_t lp = 0; lp < SCHED_NUM_ITEMS; lp++) {
-		if (tasks[lp].enabled >= 1) { // Only deal with enabled tasks
-			uint32_t tmp = tasks[lp].dueTicks;
-			if ((tasks[lp].enabled == 2) || (tmp <= numRollFwd)) { // Time to execute this task
-				int32_t nextdelta = tasks[lp].workFunc(); // Call the scheduled work
-				if (nextdelta >= 0) { // Re-arm
-					tmp = nextdelta;
-					tasks[lp].enabled = 1;
-				} else { // Putting task to sleep until awakened by Sched_SetState
-					tasks[lp].enabled = 0;
+	Sched_DrainEvents(curTick);
+
+	for (uint8_t prio = 0; prio < SCHED_NUM_PRIOS; prio++) {
+		uint8_t numdue = 0;
+
+		// Only the top of each heap has to be looked at, an idle pass ends right here.
+		// Everything due is pulled out first so a task re-arming itself with
+		// a zero delay runs on the next pass instead of starving the others.
+		while (HeapTopIsDue(prio, schedtime)) {
+			due[numdue++] = heap[prio][0];
+			HeapRemove(heap[prio][0]);
+		}
+
+		for (uint8_t lp = 0; lp < numdue; lp++) {
+			uint8_t tasknum = due[lp];
+			if (tasks[tasknum].enabled == 0) continue; // Put to sleep by an earlier task in this pass
+
+			if (tasks[tasknum].heappos != NOT_QUEUED) {
+				// Re-armed by an earlier task in this pass, only run it now if it's still due
+				if ((int32_t)(tasks[tasknum].dueTicks - schedtime) > 0) continue;
+				HeapRemove(tasknum);
+			}
+
+			uint32_t starttick = Sched_GetTick();
+
+			// Yield to any higher priority task that became due while running the
+			// ones before this, the rest of this class is picked up on the next pass
+			uint32_t now = schedtime + (starttick - curTick);
+			uint8_t yield = 0;
+			for (uint8_t hp = 0; hp < prio; hp++) {
+				yield |= HeapTopIsDue(hp, now);
+			}
+			if (yield) {
+				for (; lp < numdue; lp++) {
+					tasknum = due[lp];
+					if (tasks[tasknum].enabled && tasks[tasknum].heappos == NOT_QUEUED) {
+						HeapArm(tasknum, tasks[tasknum].dueTicks);
+					}
 				}
-			} else {
-				tmp -= numRollFwd;
+				return 0;
 			}
-			tasks[lp].dueTicks = tmp;
-			if (tmp < shortestwait) {
-				shortestwait = tmp;
+
+			uint32_t dueticks = tasks[tasknum].dueTicks; // The task may well re-arm itself while running
+			int32_t nextdelta = tasks[tasknum].workFunc(); // Call the scheduled work
+			uint32_t runticks = Sched_GetTick() - starttick;
+
+			// Deadline relative to when this pass started plus time spent on earlier tasks in the pass
+			uint32_t lateticks = (schedtime - dueticks) + (starttick - curTick);
+			SchedStats_t* st = &stats[tasknum];
+			uint32_t jitterticks = (lateticks > st->lastLateTicks) ?
+				(lateticks - st->lastLateTicks) : (st->lastLateTicks - lateticks);
+			if (st->calls == 0) jitterticks = 0;
+			st->calls++;
+			st->totalRunTicks += runticks;
+			if (runticks > st->maxRunTicks) st->maxRunTicks = runticks;
+			st->totalLateTicks += lateticks;
+			if (lateticks > st->maxLateTicks) st->maxLateTicks = lateticks;
+			st->lastLateTicks = lateticks;
+			st->totalJitterTicks += jitterticks;
+			if (jitterticks > st->maxJitterTicks) st->maxJitterTicks = jitterticks;
+
+			if (nextdelta >= 0) { // Re-arm
+				HeapArm(tasknum, schedtime + nextdelta);
+				tasks[tasknum].enabled = 1;
+			} else { // Putting task to sleep until awakened by Sched_SetState
+				HeapRemove(tasknum);
+				tasks[tasknum].enabled = 0;
 			}
 		}
 	}
+
 	// Unless a (wake-up) interrupt calls Sched_SetState, this is how
-	// long it's OK to sleep until next task is due
+	// long it's OK to sleep until next task is due. Counted from now, not from
+	// the start of this pass, Sched_Sleep arms the match relative to T0TC and
+	// would otherwise wake up late by the time the tasks above took to run.
+	uint32_t now = schedtime + (Sched_GetTick() - curTick);
+	int32_t shortestwait = 0x7fffffff;
+	for (uint8_t prio = 0; prio < SCHED_NUM_PRIOS; prio++) {
+		if (heapsize[prio]) {
+			int32_t wait = (int32_t)(tasks[heap[prio][0]].dueTicks - now);
+			if (wait < shortestwait) {
+				shortestwait = wait;
+			}
+		}
+	}
+	if (shortestwait < 0 || evqhead != evqtail) {
+		shortestwait = 0; // Overdue or posted to while running tasks
+	}
 	return shortestwait;
 }
 
-void BusyWait( uint32_t numticks ) {
+void Sched_GetStats(Task_t tasknum, SchedStats_t* st) {
+	if (tasknum < SCHED_MAX_TASKS) {
+		memcpy(st, &stats[tasknum], sizeof(SchedStats_t));
+	} else {
+		memset(st, 0, sizeof(SchedStats_t));
+	}
+}
+
+void Sched_ListStats(void) {
+	printf("\n%-12s %9s %8s %8s %8s %8s %8s %8s", "Task", "Calls",
+	       "RunAvg", "RunMax", "LateAvg", "LateMax", "JitAvg", "JitMax");
+	for (uint8_t lp = 0; lp < SCHED_NUM_ITEMS; lp++) {
+		SchedStats_t st;
+		Sched_GetStats(lp, &st);
+		if (st.calls == 0) continue;
+		printf("\n%-12s %9u %8u %8u %8u %8u %8u %8u", tasknames[lp], (unsigned int)st.calls,
+		       (unsigned int)Sched_TicksToUs(st.totalRunTicks / st.calls), (unsigned int)Sched_TicksToUs(st.maxRunTicks),
+		       (unsigned int)Sched_TicksToUs(st.totalLateTicks / st.calls), (unsigned int)Sched_TicksToUs(st.maxLateTicks),
+		       (unsigned int)Sched_TicksToUs(st.totalJitterTicks / st.calls), (unsigned int)Sched_TicksToUs(st.maxJitterTicks));
+	}
+	printf("\n(all times in us)\n");
+}
+
+// Waits until the next deadline (or any other interrupt) in idle mode.
+// Returns the number of ticks that has to be fast-forwarded on the next Sched_Do,
+// this is always 0 in idle mode as Timer0 keeps counting while the core is stopped.
+uint32_t Sched_Sleep(int32_t sleeptime) {
+	if (sleeptime < SLEEP_MIN_TICKS) {
+		return 0; // Not worth it, just spin around once more
+	}
+
+	// With IRQs masked the VIC still wakes the core up, the pending handler then
+	// runs as soon as IRQs are restored. This closes the window where the match
+	// could fire between arming it and actually entering idle mode.
+	uint32_t save = VIC_DisableIRQ();
+	T0MR0 = T0TC + sleeptime; // It's perfectly fine if this wraps
 	T0IR = 0x01; // Reset interrupt
-	T0MR0 = 1 + T0TC + numticks; // It's perfectly fine if this wraps
-	while (!(T0IR & 0x01)); // Wait for match
+	T0MCR = 0x01; // Interrupt on MR0 match
+	if ((int32_t)(T0MR0 - T0TC) > 0 && evqhead == evqtail) {
+		PCON = 0x01; // Idle mode, stops the core clock until the next interrupt
+	}
+	VIC_RestoreIRQ(save);
+	return 0;
+}
+
+void BusyWait( uint32_t numticks ) {
+	uint32_t start = T0TC;
+	while ((T0TC - start) <= numticks); // It's perfectly fine if this wraps
 }
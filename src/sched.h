@@ -15,6 +15,9 @@
 #define TICKS_US(x) ((uint32_t)(((((double)x * (double)PCLKFREQ) / ((double)TIMER_PRESCALER * 1000.0f * 1000.0f))) + 0.5f))
 #define TICKS_NS(x) ((uint32_t)(((((double)x * (double)PCLKFREQ) / ((double)TIMER_PRESCALER * 1000.0f * 1000.0f * 1000.0f))) + 0.5f))
 
+// Shorter waits than this are not worth entering idle mode for
+#define SLEEP_MIN_TICKS (TICKS_US(20))
+
 typedef int32_t (*SchedCall_t)(void);
 typedef enum eTask {
 	SLEEP_WORK=0,
@@ -29,15 +32,59 @@ typedef enum eTask {
 	REFLOW_WORK,
 	SYSFANSENSE_WORK,
 	NV_WORK,
+	TELEMETRY_WORK,
+	SENSOR_WORK,
+	I2C_WORK,
+	SPIBRIDGE_WORK,
 	SCHED_NUM_ITEMS // Last value
 } Task_t;
 
+// Size of the task table. Host tools can build the scheduler with room for
+// more tasks than there are names above, the firmware never needs that.
+#ifndef SCHED_MAX_TASKS
+#define SCHED_MAX_TASKS SCHED_NUM_ITEMS
+#endif
+
+// When several tasks are due at the same time the higher priority class runs first,
+// lower priority tasks also yield to higher priority ones becoming due during a pass
+typedef enum eSchedPrio {
+	SCHED_PRIO_REALTIME=0, // Control loop
+	SCHED_PRIO_NORMAL, // Default for all tasks
+	SCHED_PRIO_BACKGROUND, // UI and housekeeping
+	SCHED_NUM_PRIOS // Last value
+} SchedPrio_t;
+
+// Per-task execution statistics, all times are in Timer0 ticks.
+// Lateness is how long after its deadline a task actually started,
+// jitter is the change in lateness between two consecutive runs.
+typedef struct {
+	uint32_t calls;
+	uint32_t maxRunTicks;
+	uint64_t totalRunTicks;
+	uint32_t lastLateTicks;
+	uint32_t maxLateTicks;
+	uint64_t totalLateTicks;
+	uint32_t maxJitterTicks;
+	uint64_t totalJitterTicks;
+} SchedStats_t;
+
 void Sched_Init(void);
 uint32_t Sched_GetTick(void);
+uint64_t Sched_GetTick64(void);
+uint64_t Sched_TicksToUs(uint64_t ticks);
+uint64_t Sched_TicksToMs(uint64_t ticks);
+uint64_t Sched_GetUs(void);
+uint64_t Sched_GetMs(void);
 void Sched_SetState(Task_t tasknum, uint8_t enable, int32_t future);
 uint8_t Sched_IsOverride(void);
 void Sched_SetWorkfunc(Task_t tasknum, SchedCall_t func);
+void Sched_SetPriority(Task_t tasknum, SchedPrio_t prio);
+void Sched_PostFromISR(Task_t tasknum, uint32_t events, int32_t future);
+uint32_t Sched_GetEvents(Task_t tasknum);
 int32_t Sched_Do(uint32_t fastforward);
+uint32_t Sched_Sleep(int32_t sleeptime);
+void Sched_GetStats(Task_t tasknum, SchedStats_t* stats);
+void Sched_ListStats(void);
 void BusyWait( uint32_t numticks );
 
 #endif /* SCHED_H_ */
@@ -7,6 +7,7 @@
 #include "onewire.h"
 #include "max31855.h"
 #include "nvstorage.h"
+#include "sched.h"
 
 #include "sensor.h"
 
@@ -20,18 +21,124 @@
 */
 //#define MAXTEMPOVERRIDE
 
+// Temperatures are in 1/SENSOR_TEMP_SCALE degC, Sensor_DoConversion runs every
+// control tick and soft-float routines would be most of its cost without an FPU
+
 // Gain adjust, this may have to be calibrated per device if factory trimmer adjustments are off
-static float adcgainadj[2];
+#define ADC_GAIN_FRACBITS (12)
+static int32_t adcgainadj[2];
  // Offset adjust, this will definitely have to be calibrated per device
-static float adcoffsetadj[2];
+static int32_t adcoffsetadj[2];
 
-static float temperature[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+static int32_t temperature[4] = { 0, 0, 0, 0 };
+static uint64_t temperaturems[4]; // When each reading was sampled, see Sched_GetMs
 static uint8_t tempvalid = 0;
 static uint8_t cjsensorpresent = 0;
 
 // The feedback temperature
-static float avgtemp;
-static float coldjunction;
+static int32_t avgtemp;
+static int32_t coldjunction;
+static uint64_t coldjunctionms;
+
+/*
+ * Acquisition pipeline. Conversions on the 1-wire bus and on the SPI
+ * thermocouple interfaces are started together, and once both are read back
+ * the whole set is snapshotted so the control loop never sees a mix of old and
+ * new readings. Cycles are timed to complete just before a control tick: the
+ * tick grid is learned from the Sensor_DoConversion calls, and the lead time
+ * from how long recent cycles took. The ADC oversamples continuously and is
+ * read directly on each tick.
+ */
+#define SENSOR_LEAD_MARGIN_MS (5)
+#define SENSOR_IDLE_CYCLE_MS (100)
+
+typedef struct {
+	uint8_t tcpresent[4];
+	int16_t tctemp[4];
+	int16_t tccj[4];
+	uint64_t tcms[4];
+	int16_t cjtemp; // On-board 1-wire temperature sensor, 999C if absent
+	uint64_t cjms;
+} SensorSet_t;
+
+static SensorSet_t sampleset;
+static uint8_t acquiring = 0;
+static uint32_t acqstart;
+static uint32_t acqlead = 0; // Recent acquisition time, in Timer0 ticks
+static uint32_t lastcall = 0; // Tick grid of the Sensor_DoConversion caller
+static uint32_t callperiod = 0;
+
+// Latest readings from the external interfaces, a 1-wire TC takes precedence over an SPI one
+static void Sensor_Collect(void) {
+	for (int i = 0; i < 4; i++) { // Get 4 TC channels
+		sampleset.tcpresent[i] = OneWire_IsTCPresent(i);
+		if (sampleset.tcpresent[i]) {
+			sampleset.tctemp[i] = OneWire_GetTCReading(i);
+			sampleset.tccj[i] = OneWire_GetTCColdReading(i);
+			sampleset.tcms[i] = OneWire_GetTCTimestamp(i);
+		} else {
+			sampleset.tcpresent[i] = SPI_IsTCPresent(i);
+			if (sampleset.tcpresent[i]) {
+				sampleset.tctemp[i] = SPI_GetTCReading(i);
+				sampleset.tccj[i] = SPI_GetTCColdReading(i);
+				sampleset.tcms[i] = SPI_GetTCTimestamp(i);
+			}
+		}
+	}
+	sampleset.cjtemp = OneWire_GetTempSensorReading();
+	sampleset.cjms = OneWire_GetTempSensorTimestamp();
+}
+
+// Delay until the next cycle has to start to be done right before a control tick
+static int32_t Sensor_NextCycle(uint32_t now) {
+	uint32_t lead = acqlead + TICKS_MS(SENSOR_LEAD_MARGIN_MS);
+	if (callperiod == 0 || (now - lastcall) > 2 * callperiod) {
+		return TICKS_MS(SENSOR_IDLE_CYCLE_MS); // Not consumed at a steady rate
+	}
+	uint32_t start = lastcall + callperiod - lead;
+	while ((int32_t)(start - now) < 0) {
+		start += callperiod;
+	}
+	return start - now;
+}
+
+static int32_t Sensor_Work(void) {
+	if (OneWire_IsAcquiring() || SPI_TC_IsAcquiring()) {
+		return -1; // Woken up again by whichever finishes last
+	}
+
+	uint32_t now = Sched_GetTick();
+	if (acquiring) {
+		acquiring = 0;
+		Sensor_Collect();
+
+		// Follow increases right away but decreases slowly, one slow cycle
+		// would otherwise make the next one miss its tick
+		uint32_t took = now - acqstart;
+		if (took > acqlead) {
+			acqlead = took;
+		} else {
+			acqlead -= (acqlead - took) / 16;
+		}
+		return Sensor_NextCycle(now);
+	}
+
+	acqstart = now;
+	if (OneWire_Acquire(SENSOR_WORK) == 0) {
+		acquiring = 1;
+	}
+	if (SPI_TC_Acquire(SENSOR_WORK) == 0) {
+		acquiring = 1;
+	}
+	return -1; // Nothing but the ADC if nothing was started
+}
+
+void Sensor_Init(void) {
+	Sensor_Collect(); // Whatever the interfaces read while probing
+	Sched_SetWorkfunc(SENSOR_WORK, Sensor_Work);
+	Sched_SetPriority(SENSOR_WORK, SCHED_PRIO_REALTIME);
+	Sched_SetState(SENSOR_WORK, 2, 0);
+}
 
 void Sensor_ValidateNV(void) {
 	int temp;
@@ -41,115 +148,119 @@ void Sensor_ValidateNV(void) {
 		temp = 100;
 		NV_SetConfig(TC_LEFT_GAIN, temp); // Default unity gain
 	}
-	adcgainadj[0] = ((float)temp) * 0.01f;
+	adcgainadj[0] = ((temp << ADC_GAIN_FRACBITS) + 50) / 100;
 
 	temp = NV_GetConfig(TC_RIGHT_GAIN);
 	if (temp == 255) {
 		temp = 100;
 		NV_SetConfig(TC_RIGHT_GAIN, temp); // Default unity gain
 	}
-	adcgainadj[1] = ((float)temp) * 0.01f;
+	adcgainadj[1] = ((temp << ADC_GAIN_FRACBITS) + 50) / 100;
 
 	temp = NV_GetConfig(TC_LEFT_OFFSET);
 	if (temp == 255) {
 		temp = 100;
 		NV_SetConfig(TC_LEFT_OFFSET, temp); // Default +/-0 offset
 	}
-	adcoffsetadj[0] = ((float)(temp - 100)) * 0.25f;
+	adcoffsetadj[0] = (temp - 100) * SENSOR_TEMP_SCALE / 4; // 0.25C steps
 
 	temp = NV_GetConfig(TC_RIGHT_OFFSET);
 	if (temp == 255) {
 		temp = 100;
 		NV_SetConfig(TC_RIGHT_OFFSET, temp); // Default +/-0 offset
 	}
-	adcoffsetadj[1] = ((float)(temp - 100)) * 0.25f;
+	adcoffsetadj[1] = (temp - 100) * SENSOR_TEMP_SCALE / 4; // 0.25C steps
 }
 
 
 void Sensor_DoConversion(void) {
 	uint16_t temp[2];
+	uint32_t now = Sched_GetTick();
+	uint64_t nowms = Sched_GetMs();
+
+	if (lastcall) {
+		uint32_t period = now - lastcall;
+		callperiod = callperiod ? (3 * callperiod + period) / 4 : period;
+	}
+	lastcall = now;
+
 	/*
 	* These are the temperature readings we get from the thermocouple interfaces
 	* Right now it is assumed that if they are indeed present the first two
 	* channels will be used as feedback
 	*/
-	float tctemp[4], tccj[4];
-	uint8_t tcpresent[4];
+	const int16_t* tctemp = sampleset.tctemp;
+	const int16_t* tccj = sampleset.tccj;
+	const uint8_t* tcpresent = sampleset.tcpresent;
+	const uint64_t* tcms = sampleset.tcms;
 	tempvalid = 0; // Assume no valid readings;
-	for (int i = 0; i < 4; i++) { // Get 4 TC channels
-		tcpresent[i] = OneWire_IsTCPresent(i);
+	for (int i = 2; i < 4; i++) {
 		if (tcpresent[i]) {
-			tctemp[i] = OneWire_GetTCReading(i);
-			tccj[i] = OneWire_GetTCColdReading(i);
-			if (i > 1) {
-				temperature[i] = tctemp[i];
-				tempvalid |= (1 << i);
-			}
-		} else {
-			tcpresent[i] = SPI_IsTCPresent(i);
-			if (tcpresent[i]) {
-				tctemp[i] = SPI_GetTCReading(i);
-				tccj[i] = SPI_GetTCColdReading(i);
-				if (i > 1) {
-					temperature[i] = tctemp[i];
-					tempvalid |= (1 << i);
-				}
-			}
+			temperature[i] = tctemp[i];
+			temperaturems[i] = tcms[i];
+			tempvalid |= (1 << i);
 		}
 	}
 
 	// Assume no CJ sensor
 	cjsensorpresent = 0;
 	if (tcpresent[0] && tcpresent[1]) {
-		avgtemp = (tctemp[0] + tctemp[1]) / 2.0f;
+		avgtemp = (tctemp[0] + tctemp[1] + 1) >> 1;
 		temperature[0] = tctemp[0];
 		temperature[1] = tctemp[1];
+		temperaturems[0] = tcms[0];
+		temperaturems[1] = tcms[1];
 		tempvalid |= 0x03;
-		coldjunction = (tccj[0] + tccj[1]) / 2.0f;
+		coldjunction = (tccj[0] + tccj[1] + 1) >> 1;
+		coldjunctionms = tcms[0];
 		cjsensorpresent = 1;
 	} else if (tcpresent[2] && tcpresent[3]) {
-		avgtemp = (tctemp[2] + tctemp[3]) / 2.0f;
+		avgtemp = (tctemp[2] + tctemp[3] + 1) >> 1;
 		temperature[0] = tctemp[2];
 		temperature[1] = tctemp[3];
+		temperaturems[0] = tcms[2];
+		temperaturems[1] = tcms[3];
 		tempvalid |= 0x03;
 		tempvalid &= ~0x0C;
-		coldjunction = (tccj[2] + tccj[3]) / 2.0f;
+		coldjunction = (tccj[2] + tccj[3] + 1) >> 1;
+		coldjunctionms = tcms[2];
 		cjsensorpresent = 1;
 	} else {
 		// If the external TC interface is not present we fall back to the
 		// built-in ADC, with or without compensation
-		coldjunction = OneWire_GetTempSensorReading();
-		if (coldjunction < 127.0f) {
+		coldjunction = sampleset.cjtemp;
+		coldjunctionms = sampleset.cjms;
+		if (coldjunction < 127 * SENSOR_TEMP_SCALE) {
 			cjsensorpresent = 1;
 		} else {
-			coldjunction = 25.0f; // Assume 25C ambient if not found
+			coldjunction = 25 * SENSOR_TEMP_SCALE; // Assume 25C ambient if not found
+			coldjunctionms = nowms;
 		}
 		temp[0] = ADC_Read(1);
 		temp[1] = ADC_Read(2);
 
-		// ADC oversamples to supply 4 additional bits of resolution
-		temperature[0] = ((float)temp[0]) / 16.0f;
-		temperature[1] = ((float)temp[1]) / 16.0f;
-
-		// Gain adjust
-		temperature[0] *= adcgainadj[0];
-		temperature[1] *= adcgainadj[1];
+		// ADC oversamples to supply 4 additional bits of resolution, that is
+		// already 1/16 degC. Gain adjust, rounded back to that resolution.
+		temperature[0] = ((int32_t)temp[0] * adcgainadj[0] + (1 << (ADC_GAIN_FRACBITS - 1))) >> ADC_GAIN_FRACBITS;
+		temperature[1] = ((int32_t)temp[1] * adcgainadj[1] + (1 << (ADC_GAIN_FRACBITS - 1))) >> ADC_GAIN_FRACBITS;
 
 		// Offset adjust
 		temperature[0] += coldjunction + adcoffsetadj[0];
 		temperature[1] += coldjunction + adcoffsetadj[1];
 
+		temperaturems[0] = temperaturems[1] = nowms - ADC_AVERAGE_AGE_MS;
+
 		tempvalid |= 0x03;
 
-		avgtemp = (temperature[0] + temperature[1]) / 2.0f;
+		avgtemp = (temperature[0] + temperature[1] + 1) >> 1;
 	}
 
 #ifdef MAXTEMPOVERRIDE
 	// If one of the temperature sensors reports higher than 5C above
 	// the average, use that as control input
-	float newtemp = avgtemp;
+	int32_t newtemp = avgtemp;
 	for (int i=0; i < 4; i++) {
-		if (tcpresent[i] && temperature[i] > (avgtemp + 5.0f) && temperature[i] > newtemp) {
+		if (tcpresent[i] && temperature[i] > (avgtemp + 5 * SENSOR_TEMP_SCALE) && temperature[i] > newtemp) {
 			newtemp = temperature[i];
 		}
 	}
@@ -164,7 +275,8 @@ uint8_t Sensor_ColdjunctionPresent(void) {
 }
 
 
-float Sensor_GetTemp(TempSensor_t sensor) {
+// In 1/SENSOR_TEMP_SCALE degC, this is what the control loop should use
+int32_t Sensor_GetTempFixed(TempSensor_t sensor) {
 	if (sensor == TC_COLD_JUNCTION) {
 		return coldjunction;
 	} else if(sensor == TC_AVERAGE) {
@@ -172,8 +284,28 @@ float Sensor_GetTemp(TempSensor_t sensor) {
 	} else if(sensor < TC_NUM_ITEMS) {
 		return temperature[sensor - TC_LEFT];
 	} else {
-		return 0.0f;
+		return 0;
+	}
+}
+
+// For display
+float Sensor_GetTemp(TempSensor_t sensor) {
+	return (float)Sensor_GetTempFixed(sensor) / SENSOR_TEMP_SCALE;
+}
+
+// Age in ms of the reading, the average is as old as the older of the two sides
+uint32_t Sensor_GetAge(TempSensor_t sensor) {
+	uint64_t ms;
+	if (sensor == TC_COLD_JUNCTION) {
+		ms = coldjunctionms;
+	} else if (sensor == TC_AVERAGE) {
+		ms = temperaturems[0] < temperaturems[1] ? temperaturems[0] : temperaturems[1];
+	} else if (sensor < TC_NUM_ITEMS) {
+		ms = temperaturems[sensor - TC_LEFT];
+	} else {
+		return 0;
 	}
+	return (uint32_t)(Sched_GetMs() - ms);
 }
 
 uint8_t Sensor_IsValid(TempSensor_t sensor) {
@@ -191,11 +323,11 @@ void Sensor_ListAll(void) {
 	int count = 5;
 	char* names[] = {"Left", "Right", "Extra 1", "Extra 2", "Cold junction"};
 	TempSensor_t sensors[] = {TC_LEFT, TC_RIGHT, TC_EXTRA1, TC_EXTRA2, TC_COLD_JUNCTION};
-	char* format = "\n%13s: %4.1fdegC";
+	char* format = "\n%13s: %4.1fdegC (%ums old)";
 
 	for (int i = 0; i < count; i++) {
 		if (Sensor_IsValid(sensors[i])) {
-			printf(format, names[i], Sensor_GetTemp(sensors[i]));
+			printf(format, names[i], Sensor_GetTemp(sensors[i]), (unsigned int)Sensor_GetAge(sensors[i]));
 		}
 	}
 	if (!Sensor_IsValid(TC_COLD_JUNCTION)) {
@@ -11,14 +11,21 @@ typedef enum eTempSensor {
 	TC_NUM_ITEMS
 } TempSensor_t;
 
+// Temperatures are kept in 1/SENSOR_TEMP_SCALE degrees C, the resolution of the
+// thermocouple interfaces and the same scale the profile setpoints use
+#define SENSOR_TEMP_SCALE (16)
+#define SENSOR_TEMP_FRACBITS (4)
 
 void Sensor_ValidateNV(void);
+void Sensor_Init(void);
 void Sensor_DoConversion(void);
 
 uint8_t Sensor_ColdjunctionPresent(void);
 
+int32_t Sensor_GetTempFixed(TempSensor_t sensor);
 float Sensor_GetTemp(TempSensor_t sensor);
 uint8_t Sensor_IsValid(TempSensor_t sensor);
+uint32_t Sensor_GetAge(TempSensor_t sensor);
 
 void Sensor_ListAll(void);
 
@@ -23,6 +23,7 @@
 #include "vic.h"
 #include "circbuffer.h"
 #include "serial.h"
+#include "sched.h"
 
 #ifdef __NEWLIB__
 #define __sys_write _write
@@ -47,10 +48,7 @@
 static tcirc_buf txbuf;
 static tcirc_buf rxbuf;
 
-static void uart_putc(char thebyte) {
-	if (thebyte == '\n')
-		uart_putc('\r');
-
+static void uart_putraw(char thebyte) {
 	/* The following is done blocking. This means when you call printf() with lots of data,
 	 * it relies on the ability of the interrupt to drain the txbuf, otherwise the system
 	 * will lock up.
@@ -61,13 +59,25 @@ static void uart_putc(char thebyte) {
 		add_to_circ_buf(&txbuf, thebyte, 0);
 	}
 
-	// If interrupt is disabled, we need to start the process and enable the interrupt
-	if ((U0IER & (1<<1)) == 0) {
+	// If interrupt is disabled, we need to start the process and enable the interrupt.
+	// The interrupt may have sent the byte and disabled itself since it was queued.
+	if ((U0IER & (1<<1)) == 0 && circ_buf_has_char(&txbuf)) {
 		U0THR = get_from_circ_buf(&txbuf);
 		U0IER |= 1<<1;
 	}
 }
 
+static void uart_putc(char thebyte) {
+	if (thebyte == '\n')
+		uart_putraw('\r');
+	uart_putraw(thebyte);
+}
+
+// Sends binary data as is, printf output gets a \r added to every \n
+void uart_writebin(const uint8_t* buf, int len) {
+	while (len--) uart_putraw(*buf++);
+}
+
 // Blindly read character, assuming we knew one was available
 char uart_readc(void) {
 	return get_from_circ_buf(&rxbuf);
@@ -117,7 +127,12 @@ static void __attribute__ ((interrupt ("IRQ"))) Serial_IRQHandler( void ) {
 	// RDA Interrupt
 	if (intsrc == 0b00000100) {
 		//Don't block, as we are inside an interrupt!
-		add_to_circ_buf(&rxbuf, U0RBR, 0);
+		char ch = U0RBR;
+		add_to_circ_buf(&rxbuf, ch, 0);
+		if (ch == '\n' || ch == '\r') {
+			// Wake up main task to parse the command right away instead of on its next poll
+			Sched_PostFromISR(MAIN_WORK, 0, 0);
+		}
 	}
 
 	// ACK IRQ with VIC as the last thing
@@ -1,6 +1,8 @@
 #ifndef SERIAL_H_
 #define SERIAL_H_
 
+#include <stdint.h>
+
 void Serial_Init(void);
 
 //non-blocking read
@@ -11,4 +13,7 @@ int uart_isrxready(void);
 
 int uart_readline(char* buffer, int max_len);
 
+//blocking write without newline translation
+void uart_writebin(const uint8_t* buf, int len);
+
 #endif /* SERIAL_H_ */
@@ -30,6 +30,12 @@ static setupMenuStruct setupmenu[] = {
 	{"Left TC offset  %+1.2f", TC_LEFT_OFFSET, 0, 200, -100, 0.25f},
 	{"Right TC gain    %1.2f", TC_RIGHT_GAIN, 10, 190, 0, 0.01f},
 	{"Right TC offset %+1.2f", TC_RIGHT_OFFSET, 0, 200, -100, 0.25f},
+	{"Log interval   %4.2fs", TELEMETRY_INTERVAL, 1, 200, 0, 0.05f},
+	{"Feedforward     %4.0f", REFLOW_FF_GAIN, 0, 254, 0, 1.0f},
+	{"MPC control     %4.0f", REFLOW_MPC, 0, 1, 0, 1.0f},
+	{"MPC model gain %4.0f`", MPC_GAIN, 10, 254, 0, 2.0f},
+	{"MPC model tau  %4.0fs", MPC_TAU, 1, 254, 0, 2.0f},
+	{"MPC deadtime   %4.1fs", MPC_DEADTIME, 0, 250, 0, 0.1f},
 };
 #define NUM_SETUP_ITEMS (sizeof(setupmenu) / sizeof(setupmenu[0]))
 
@@ -48,6 +54,9 @@ float Setup_getValue(int item) {
 }
 
 void Setup_setValue(int item, int value) {
+	// The serial "setting" command takes any value, keep it within what the menu allows
+	if (value < setupmenu[item].minval) value = setupmenu[item].minval;
+	if (value > setupmenu[item].maxval) value = setupmenu[item].maxval;
 	NV_SetConfig(setupmenu[item].nvval, value);
 	Reflow_ValidateNV();
 }
@@ -61,16 +61,16 @@ static int32_t SystemFanSense_Work(void) {
 	uint8_t sysfanspeed = 0;
 
 	if (Sensor_IsValid(TC_COLD_JUNCTION)) {
-		float systemp = Sensor_GetTemp(TC_COLD_JUNCTION);
+		int32_t systemp = Sensor_GetTempFixed(TC_COLD_JUNCTION);
 
 		// Sort this out with something better at some point
-		if (systemp > 50.0f) {
+		if (systemp > 50 * SENSOR_TEMP_SCALE) {
 			sysfanspeed = 0xff;
-		} else if (systemp > 45.0f) {
+		} else if (systemp > 45 * SENSOR_TEMP_SCALE) {
 			sysfanspeed = 0xc0;
-		} else if (systemp > 42.0f) {
+		} else if (systemp > 42 * SENSOR_TEMP_SCALE) {
 			sysfanspeed = 0x80;
-		} else if (systemp > 40.0f) {
+		} else if (systemp > 40 * SENSOR_TEMP_SCALE) {
 			sysfanspeed = 0x50;
 		}
 	} else {
@@ -62,6 +62,10 @@ spaced 10 seconds apart for a run-time of up to 470s (in original SW they're spa
 15 seconds apart due to the slowdown of the RTC clock though). Unused space from address
 0x62 to 0x7d (28 bytes) in each profile.
 
+This firmware keeps its NV settings at 0x62 and converts the two profiles above on
+first boot to a store of segment-based custom profiles filling the rest (0x00-0x61 and
+0x80-0xff), see reflow_profiles.c. Original software won't recognize them after that.
+
 Wave7
 0x56 0x57 0x00 0x14 0x00 0x23 0x00 0x2c 0x00 0x39 0x00 0x42 0x00 0x49 0x00 0x52
 0x00 0x5b 0x00 0x64 0x00 0x67 0x00 0x6a 0x00 0x73 0x00 0x78 0x00 0x7b 0x00 0x82